@@ -0,0 +1,409 @@
+// asynclog.c
+// the console writer behind the flower client and the garden server
+
+// the motion thread used to printf the petal angles every few ticks while still holding
+// the flower mutex, and printf to a terminal can take a surprisingly long time
+// now a print is a vsnprintf onto the stack plus a memcpy into a ring only this thread writes to,
+// the fwrite and fflush happen on the writer thread with nobody waiting on them
+//
+// the rings are single producer single consumer so neither side ever takes a lock,
+// the only lock left is the one the writer sleeps on, and a printing thread only touches it
+// when the writer said it is about to go to sleep (the sleeping flag and the ring tail are
+// both seq_cst so either the writer sees the new line or the printer sees the flag, never neither)
+
+#include "asynclog.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define LOG_LINE_MAX   512
+#define LOG_RATE_SLOTS 64     // format strings one thread keeps rate limit state for, power of two
+#define LOG_IDLE_MS    250    // writer wakes at least this often to report suppressed lines
+
+enum { RING_OWNED, RING_ORPHAN, RING_FREE };
+
+// state for one format string, the owning thread counts and the writer reports
+typedef struct {
+    _Atomic(const char *) key;
+    atomic_llong  start_ms;        // when the current window began
+    int           count;           // lines let through in this window (owner only)
+    atomic_ulong  suppressed;      // lines held back, the writer takes them when the window ends
+} LogRate;
+
+typedef struct LogRing LogRing;
+struct LogRing {
+    LogRing      *next;            // registry list, rings are only ever pushed onto it
+    atomic_int    state;           // RING_*, a ring whose thread exited is reused once drained
+    atomic_size_t head;            // next byte to write out, only the writer moves it
+    atomic_size_t tail;            // next free byte, only the owning thread moves it
+    atomic_ulong  dropped;
+    LogRate       rate[LOG_RATE_SLOTS];
+    char         *buf;
+};
+
+static struct {
+    FILE             *out;
+    size_t            cap;         // per ring, power of two
+    _Atomic(LogRing *) rings;
+    atomic_int        started;
+    atomic_int        stopping;
+    atomic_int        sleeping;    // writer is about to wait or waiting on cond
+    atomic_int        level;
+    atomic_int        burst;
+    atomic_int        per_ms;
+    unsigned long     dropped;     // from rings, added up by the writer
+    pthread_key_t     ring_key;    // only for its destructor, my_ring is the fast path
+    pthread_mutex_t   lock;
+    pthread_cond_t    cond;
+    pthread_t         tid;
+} lg = {
+    .level  = LOG_LEVEL_INFO,
+    .burst  = 20,
+    .per_ms = 1000,
+    .lock   = PTHREAD_MUTEX_INITIALIZER,
+    .cond   = PTHREAD_COND_INITIALIZER,
+};
+
+static _Thread_local LogRing *my_ring;
+
+static int64_t log_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);   // a few ns, the limit does not need better
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// thread exit, the writer drains what is left and then hands the ring to the next new thread
+static void ring_orphan(void *p) {
+    LogRing *ring = p;
+    atomic_store(&ring->state, RING_ORPHAN);
+}
+
+static LogRing *ring_get(void) {
+    if (my_ring != NULL) return my_ring;
+
+    LogRing *ring;
+    for (ring = atomic_load(&lg.rings); ring != NULL; ring = ring->next) {
+        int free_state = RING_FREE;
+        if (atomic_compare_exchange_strong(&ring->state, &free_state, RING_OWNED)) break;
+    }
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(LogRing));
+        if (ring == NULL) return NULL;
+        ring->buf = malloc(lg.cap);
+        if (ring->buf == NULL) {
+            free(ring);
+            return NULL;
+        }
+        atomic_init(&ring->state, RING_OWNED);
+        ring->next = atomic_load(&lg.rings);
+        while (!atomic_compare_exchange_weak(&lg.rings, &ring->next, ring)) {
+            // somebody else registered at the same moment, ring->next was updated, go again
+        }
+    }
+    pthread_setspecific(lg.ring_key, ring);
+    my_ring = ring;
+    return ring;
+}
+
+// copies one formatted line into this threads ring and pokes the writer if it is asleep
+static void ring_put(const char *line, size_t n) {
+    LogRing *ring = ring_get();
+    if (ring == NULL) {
+        // out of memory for a ring, slow but still better than losing the line
+        fwrite(line, 1, n, lg.out);
+        return;
+    }
+
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (lg.cap - (tail - head) < n) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    size_t off = tail & (lg.cap - 1);
+    size_t first = lg.cap - off;
+    if (first > n) first = n;
+    memcpy(ring->buf + off, line, first);
+    memcpy(ring->buf, line + first, n - first);
+    atomic_store(&ring->tail, tail + n);
+
+    if (atomic_load(&lg.sleeping)) {
+        pthread_mutex_lock(&lg.lock);
+        atomic_store(&lg.sleeping, 0);
+        pthread_cond_signal(&lg.cond);
+        pthread_mutex_unlock(&lg.lock);
+    }
+}
+
+static void emit(const char *fmt, va_list ap) {
+    char line[LOG_LINE_MAX];
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    if (n < 0) return;
+    if ((size_t)n >= sizeof(line)) {
+        // cut short, it still has to end the line or the next one gets glued onto it
+        n = sizeof(line) - 1;
+        line[n - 1] = '\n';
+    }
+
+    if (!atomic_load_explicit(&lg.started, memory_order_acquire)) {
+        // before start / after stop, nobody else is printing anyway
+        fwrite(line, 1, (size_t)n, stdout);
+        fflush(stdout);
+        return;
+    }
+    ring_put(line, (size_t)n);
+}
+
+// the one line that stands in for everything a window held back, names the format string
+// up to its newline so it is clear which message it was
+static int suppressed_note(char *out, size_t size, unsigned long held, const char *fmt) {
+    int len = (int)strcspn(fmt, "\n");
+    if (len > 60) len = 60;
+    int n = snprintf(out, size, "(%lu more like \"%.*s\" suppressed)\n", held, len, fmt);
+    if (n < 0) return 0;
+    return ((size_t)n < size) ? n : (int)size - 1;
+}
+
+// a window is over, whatever it held back goes out from this thread
+static void flush_held(LogRate *r) {
+    unsigned long held = atomic_exchange(&r->suppressed, 0);
+    const char *key = atomic_load_explicit(&r->key, memory_order_relaxed);
+    if (held > 0 && key != NULL) {
+        char note[LOG_LINE_MAX];
+        int n = suppressed_note(note, sizeof(note), held, key);
+        if (n > 0) ring_put(note, (size_t)n);
+    }
+}
+
+// the slot for fmt in this threads table, open addressing on the whole pointer so two formats
+// never share a window, keys are string literals so they are never removed and a lookup stops
+// at the first empty slot
+// only when every slot is taken (more formats than any one thread in here logs) does fmt get
+// the slot along its probe that was used longest ago
+static LogRate *rate_slot(LogRing *ring, const char *fmt) {
+    unsigned h = (unsigned)(((uintptr_t)fmt * 0x9E3779B97F4A7C15ull) >> 32);
+    LogRate *oldest = NULL;
+    for (int k = 0; k < LOG_RATE_SLOTS; k++) {
+        LogRate *r = &ring->rate[(h + k) & (LOG_RATE_SLOTS - 1)];
+        const char *key = atomic_load_explicit(&r->key, memory_order_relaxed);
+        if (key == fmt || key == NULL) return r;
+        if (oldest == NULL || atomic_load_explicit(&r->start_ms, memory_order_relaxed) <
+                              atomic_load_explicit(&oldest->start_ms, memory_order_relaxed)) {
+            oldest = r;
+        }
+    }
+    return oldest;
+}
+
+// 1 if fmt still has room in its window, counts it as suppressed otherwise
+static int rate_allow(const char *fmt) {
+    int burst = atomic_load_explicit(&lg.burst, memory_order_relaxed);
+    if (burst <= 0 || !atomic_load_explicit(&lg.started, memory_order_relaxed)) return 1;
+    LogRing *ring = ring_get();
+    if (ring == NULL) return 1;
+
+    LogRate *r = rate_slot(ring, fmt);
+    int64_t now = log_now_ms();
+    if (atomic_load_explicit(&r->key, memory_order_relaxed) != fmt) {
+        // new slot, or a full table took it from another format string,
+        // whatever that one held back is reported right here
+        flush_held(r);
+        atomic_store_explicit(&r->key, fmt, memory_order_relaxed);
+        atomic_store_explicit(&r->start_ms, now, memory_order_relaxed);
+        r->count = 0;
+    } else if (now - atomic_load_explicit(&r->start_ms, memory_order_relaxed) >=
+               atomic_load_explicit(&lg.per_ms, memory_order_relaxed)) {
+        flush_held(r);
+        atomic_store_explicit(&r->start_ms, now, memory_order_relaxed);
+        r->count = 0;
+    }
+
+    if (r->count < burst) {
+        r->count++;
+        return 1;
+    }
+    atomic_fetch_add_explicit(&r->suppressed, 1, memory_order_relaxed);
+    return 0;
+}
+
+// writes out whatever one ring holds, returns how many bytes that was
+static size_t ring_drain(LogRing *ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load(&ring->tail);
+    size_t total = tail - head;
+
+    while (head != tail) {
+        // up to the end of the ring in one go, the wrapped part next time around
+        size_t off = head & (lg.cap - 1);
+        size_t n = tail - head;
+        if (n > lg.cap - off) n = lg.cap - off;
+        fwrite(ring->buf + off, 1, n, lg.out);
+        head += n;
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+    }
+
+    unsigned long d = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+    lg.dropped += d;
+    return total;
+}
+
+// windows that ended with lines held back and no new line since to report them get their
+// summary line from here, so a burst that stops dead is still accounted for
+// the key is read after the count is taken, if the owner reused the slot in between it already
+// took the count itself so at worst the note names the wrong format for a count of 0 (not printed)
+static void report_suppressed(LogRing *ring, int64_t now, int per_ms) {
+    for (int i = 0; i < LOG_RATE_SLOTS; i++) {
+        LogRate *r = &ring->rate[i];
+        if (atomic_load_explicit(&r->suppressed, memory_order_relaxed) == 0) continue;
+        if (now - atomic_load_explicit(&r->start_ms, memory_order_relaxed) < per_ms) continue;
+        unsigned long held = atomic_exchange(&r->suppressed, 0);
+        const char *key = atomic_load_explicit(&r->key, memory_order_relaxed);
+        if (held > 0 && key != NULL) {
+            char note[LOG_LINE_MAX];
+            int n = suppressed_note(note, sizeof(note), held, key);
+            fwrite(note, 1, (size_t)n, lg.out);
+        }
+    }
+}
+
+static int rings_empty(void) {
+    for (LogRing *ring = atomic_load(&lg.rings); ring != NULL; ring = ring->next) {
+        if (atomic_load(&ring->tail) != atomic_load_explicit(&ring->head, memory_order_relaxed)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void *writer_thread(void *arg) {
+    (void)arg;
+
+    while (1) {
+        int stop = atomic_load(&lg.stopping);
+        size_t wrote = 0;
+        int64_t now = log_now_ms();
+        int per_ms = atomic_load_explicit(&lg.per_ms, memory_order_relaxed);
+
+        for (LogRing *ring = atomic_load(&lg.rings); ring != NULL; ring = ring->next) {
+            wrote += ring_drain(ring);
+            report_suppressed(ring, stop ? INT64_MAX : now, per_ms);
+            int orphan = RING_ORPHAN;
+            if (atomic_load(&ring->tail) == atomic_load_explicit(&ring->head, memory_order_relaxed)) {
+                atomic_compare_exchange_strong(&ring->state, &orphan, RING_FREE);
+            }
+        }
+        fflush(lg.out);
+        if (wrote > 0) continue;
+        if (stop) break;   // stopping was seen before that last pass and it found nothing
+
+        // tell the printers we are going to sleep, then look once more in case a line
+        // slipped in before they could see the flag
+        pthread_mutex_lock(&lg.lock);
+        atomic_store(&lg.sleeping, 1);
+        if (rings_empty() && !atomic_load(&lg.stopping)) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += LOG_IDLE_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            while (atomic_load(&lg.sleeping) && !atomic_load(&lg.stopping)) {
+                if (pthread_cond_timedwait(&lg.cond, &lg.lock, &ts) == ETIMEDOUT) break;
+            }
+        }
+        atomic_store(&lg.sleeping, 0);
+        pthread_mutex_unlock(&lg.lock);
+    }
+
+    return NULL;
+}
+
+int AsyncLog_start(FILE *out, size_t cap) {
+    if (lg.cap == 0) {
+        size_t real = 4096;
+        while (real < cap) real *= 2;
+        lg.cap = real;
+        if (pthread_key_create(&lg.ring_key, ring_orphan) != 0) {
+            lg.cap = 0;
+            return 0;
+        }
+    }
+    lg.out = out;
+    lg.dropped = 0;
+    atomic_store(&lg.stopping, 0);
+
+    // started first so lines from the writer thread itself (none today) would go into a ring
+    atomic_store_explicit(&lg.started, 1, memory_order_release);
+    if (pthread_create(&lg.tid, NULL, writer_thread, NULL) != 0) {
+        atomic_store(&lg.started, 0);
+        return 0;
+    }
+    return 1;
+}
+
+void AsyncLog_setLevel(LogLevel level) {
+    atomic_store_explicit(&lg.level, (int)level, memory_order_relaxed);
+}
+
+int AsyncLog_parseLevel(const char *name, LogLevel *level) {
+    static const char *names[] = { "error", "warn", "info", "debug" };
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        if (strcasecmp(name, names[i]) == 0) {
+            *level = (LogLevel)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int AsyncLog_enabled(LogLevel level) {
+    return (int)level <= atomic_load_explicit(&lg.level, memory_order_relaxed);
+}
+
+void AsyncLog_setRateLimit(int burst, int per_ms) {
+    if (per_ms < 1) per_ms = 1;
+    atomic_store(&lg.burst, burst);
+    atomic_store(&lg.per_ms, per_ms);
+}
+
+void AsyncLog_printf(const char *fmt, ...) {
+    if (!AsyncLog_enabled(LOG_LEVEL_INFO)) return;
+    va_list ap;
+    va_start(ap, fmt);
+    emit(fmt, ap);
+    va_end(ap);
+}
+
+void AsyncLog_log(LogLevel level, const char *fmt, ...) {
+    if (!AsyncLog_enabled(level)) return;
+    if (!rate_allow(fmt)) return;
+    va_list ap;
+    va_start(ap, fmt);
+    emit(fmt, ap);
+    va_end(ap);
+}
+
+unsigned long AsyncLog_stop(void) {
+    if (!atomic_load(&lg.started)) return lg.dropped;
+
+    pthread_mutex_lock(&lg.lock);
+    atomic_store(&lg.stopping, 1);
+    pthread_cond_signal(&lg.cond);
+    pthread_mutex_unlock(&lg.lock);
+    pthread_join(lg.tid, NULL);
+
+    // lines printed from here on go straight out, the rings stay for a later start
+    atomic_store(&lg.started, 0);
+    for (LogRing *ring = atomic_load(&lg.rings); ring != NULL; ring = ring->next) {
+        ring_drain(ring);   // anything that raced the last pass
+    }
+    fflush(lg.out);
+    return lg.dropped;
+}
@@ -0,0 +1,51 @@
+// asynclog.h
+// buffered console output, callers format into a ring and one background thread does the
+// actual writing, so a slow terminal never stalls the thread that wanted to print
+// every thread gets a ring of its own so printing threads never wait on each other either,
+// and log lines have a level and are rate limited so a flood of them costs next to nothing
+
+#ifndef ASYNCLOG_H
+#define ASYNCLOG_H
+
+#include <stdio.h>
+
+typedef enum {
+    LOG_LEVEL_ERROR = 0,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,      // the default
+    LOG_LEVEL_DEBUG
+} LogLevel;
+
+// starts the writer thread, cap bytes of buffer per printing thread (rounded up to a power of two)
+// returns 0 if that failed, everything then just prints directly
+// meant to be called once per process, stop and start again keeps the rings from the first start
+int AsyncLog_start(FILE *out, size_t cap);
+
+// lines above this level are thrown away before they are even formatted
+void AsyncLog_setLevel(LogLevel level);
+
+// "error", "warn", "info" or "debug", returns 0 for anything else
+int AsyncLog_parseLevel(const char *name, LogLevel *level);
+
+// 1 if a line at this level would be kept, for callers that do real work to build the arguments
+int AsyncLog_enabled(LogLevel level);
+
+// AsyncLog_log lets through burst lines per format string every per_ms (default 20 per second)
+// and then counts the rest, the count comes out as one line once the window is over
+// burst 0 turns the limit off, the window is per thread so each reactor gets its own burst
+void AsyncLog_setRateLimit(int burst, int per_ms);
+
+// printf into the ring at info level, never blocks on the output, a line that does not fit is
+// dropped (and counted), lines from different threads never get mixed up
+// not rate limited, this is for output somebody asked for (a flowers petal angles)
+void AsyncLog_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// same with a level and the rate limit, the format string is the key so "Bad STATUS from fd=%d"
+// is limited as one no matter which fd it names, fmt has to be a string literal for that
+void AsyncLog_log(LogLevel level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// writes out everything still buffered and stops the writer thread
+// returns how many lines had to be dropped
+unsigned long AsyncLog_stop(void);
+
+#endif
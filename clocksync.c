@@ -0,0 +1,71 @@
+// clocksync.c
+// clock offset to the garden server, see clocksync.h for how the samples work
+
+#include "clocksync.h"
+#include <stdio.h>
+#include <string.h>
+
+void ClockSync_init(ClockSync *cs) {
+    memset(cs, 0, sizeof(*cs));
+    cs->best = -1;
+}
+
+// reads an unsigned decimal at *p, moves *p past it and any blanks after
+// returns 0 if there was no number there
+static int read_ms(const char **p, const char *end, int64_t *out) {
+    const char *s = *p;
+    int64_t v = 0;
+    int digits = 0;
+    while (s < end && *s >= '0' && *s <= '9') {
+        v = v * 10 + (*s - '0');
+        s++;
+        digits++;
+    }
+    while (s < end && (*s == ' ' || *s == '\t')) s++;
+    *p = s;
+    *out = v;
+    return digits > 0 && digits < 19;
+}
+
+int ClockSync_reply(ClockSync *cs, const char *s, size_t len, int64_t now_ms) {
+    if (len < 5 || memcmp(s, "TIME ", 5) != 0) return 0;
+
+    const char *p = s + 5;
+    const char *end = s + len;
+    while (end > p && (end[-1] == '\n' || end[-1] == '\r')) end--;
+    int64_t t0, server_ms;
+    if (!read_ms(&p, end, &t0) || !read_ms(&p, end, &server_ms)) return 1;
+
+    int64_t rtt = now_ms - t0;
+    if (rtt < 0) return 1;
+
+    // oldest sample goes, if it was the best one the best of the rest takes over
+    int i = cs->count % CLOCKSYNC_WINDOW;
+    cs->offset[i] = server_ms - (t0 + now_ms) / 2;
+    cs->rtt[i] = rtt;
+    cs->count++;
+
+    int n = cs->count < CLOCKSYNC_WINDOW ? cs->count : CLOCKSYNC_WINDOW;
+    cs->best = 0;
+    for (int k = 1; k < n; k++) {
+        if (cs->rtt[k] < cs->rtt[cs->best]) cs->best = k;
+    }
+    return 1;
+}
+
+int ClockSync_synced(const ClockSync *cs) {
+    return cs->best >= 0;
+}
+
+int64_t ClockSync_toLocal(const ClockSync *cs, int64_t server_ms) {
+    return cs->best >= 0 ? server_ms - cs->offset[cs->best] : server_ms;
+}
+
+int64_t ClockSync_rtt(const ClockSync *cs) {
+    return cs->best >= 0 ? cs->rtt[cs->best] : -1;
+}
+
+size_t ClockSync_request(char *out, size_t out_size, int64_t now_ms) {
+    int n = snprintf(out, out_size, "TIME %lld\n", (long long)now_ms);
+    return (n < 0 || (size_t)n >= out_size) ? 0 : (size_t)n;
+}
@@ -0,0 +1,44 @@
+// clocksync.h
+// keeps track of how far the servers CLOCK_MONOTONIC is from ours, so a command that says
+// "start at server time t" can be started at the same moment by every flower
+//
+// the flower sends TIME <t0> with its own clock, the server answers TIME <t0> <server_ms>
+// right away, and when that comes back at t1 the server read its clock somewhere in between,
+// so offset = server_ms - (t0 + t1) / 2 is off by at most half the round trip
+// the samples with the shortest round trip are the most exact, so out of the last few the
+// shortest one wins
+
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CLOCKSYNC_WINDOW 8   // samples the best one is picked from, older ones are forgotten
+
+typedef struct {
+    int64_t offset[CLOCKSYNC_WINDOW];   // server - local, ms
+    int64_t rtt[CLOCKSYNC_WINDOW];
+    int     count;                      // samples taken so far
+    int     best;                       // index of the one in use, -1 until the first sample
+} ClockSync;
+
+void ClockSync_init(ClockSync *cs);
+
+// parses a TIME reply sitting in s[0..len) (no nul needed) and adds it as a sample taken at now_ms
+// returns 1 if it was a TIME reply, even a useless one (a clock that went backwards) is swallowed
+int ClockSync_reply(ClockSync *cs, const char *s, size_t len, int64_t now_ms);
+
+// 1 once there was at least one sample
+int ClockSync_synced(const ClockSync *cs);
+
+// a time on the servers clock as a time on ours
+int64_t ClockSync_toLocal(const ClockSync *cs, int64_t server_ms);
+
+// round trip of the sample in use, for logging
+int64_t ClockSync_rtt(const ClockSync *cs);
+
+// the request to send, "TIME <now_ms>\n" into out, returns its length
+size_t ClockSync_request(char *out, size_t out_size, int64_t now_ms);
+
+#endif
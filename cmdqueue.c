@@ -0,0 +1,46 @@
+// cmdqueue.c
+// the hand off between the flower clients receiver and motion threads
+
+// before this the receiver applied commands itself under the same mutex the motion thread
+// held for a whole tick, so a command could sit behind a status build and a printf
+// now the receiver just drops the line in here and the motion thread owns the flower alone
+
+// head and tail count up forever and get masked on use, acquire / release on them is the
+// whole synchronisation, the slot contents are only ever touched by one side at a time
+// the receiver parses straight into the slot it reserved so nothing gets copied in between
+
+#include "cmdqueue.h"
+
+void CmdQueue_init(CmdQueue *q) {
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+}
+
+CmdItem *CmdQueue_reserve(CmdQueue *q) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail - head >= CMDQ_SLOTS) return NULL;
+    return &q->item[tail & (CMDQ_SLOTS - 1)];
+}
+
+void CmdQueue_commit(CmdQueue *q) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+const CmdItem *CmdQueue_front(CmdQueue *q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head == tail) return NULL;
+    return &q->item[head & (CMDQ_SLOTS - 1)];
+}
+
+void CmdQueue_pop(CmdQueue *q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+}
+
+int CmdQueue_empty(CmdQueue *q) {
+    return atomic_load_explicit(&q->head, memory_order_acquire)
+        == atomic_load_explicit(&q->tail, memory_order_acquire);
+}
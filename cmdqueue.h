@@ -0,0 +1,46 @@
+// cmdqueue.h
+// single producer single consumer queue of commands, the client receiver thread pushes
+// what the server sent and the motion thread pops it, neither side ever takes a lock
+// flower commands travel already parsed, only the odd control line (PROTO, PREDICT)
+// gets its text copied in
+
+#ifndef CMDQUEUE_H
+#define CMDQUEUE_H
+
+#include "flower.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define CMDQ_SLOTS     64    // power of two, the server never has this many commands in flight
+#define CMDQ_LINE_MAX  128   // control lines are short
+
+typedef struct {
+    FlowerCmd cmd;            // cmd.op == FLOWER_OP_NONE means look at line
+    int64_t   due_ms;         // CLOCK_MONOTONIC ms a timed command starts at, 0 for right away
+    int       len;
+    char      line[CMDQ_LINE_MAX];
+} CmdItem;
+
+typedef struct {
+    atomic_size_t head;   // next slot to pop, only the consumer moves it
+    char          pad0[64 - sizeof(atomic_size_t)];
+    atomic_size_t tail;   // next slot to push, only the producer moves it
+    char          pad1[64 - sizeof(atomic_size_t)];
+    CmdItem       item[CMDQ_SLOTS];
+} CmdQueue;
+
+void CmdQueue_init(CmdQueue *q);
+
+// producer side, the free slot to fill in place or NULL if the queue is full,
+// nothing is visible to the consumer until CmdQueue_commit
+CmdItem *CmdQueue_reserve(CmdQueue *q);
+void CmdQueue_commit(CmdQueue *q);
+
+// consumer side, oldest item or NULL if empty, it stays valid until CmdQueue_pop
+const CmdItem *CmdQueue_front(CmdQueue *q);
+void CmdQueue_pop(CmdQueue *q);
+
+// either side, 1 if nothing is queued
+int CmdQueue_empty(CmdQueue *q);
+
+#endif
@@ -12,17 +12,11 @@
 #include "flower.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
-// helper to strip newline characters off the end of a c string
-// this keeps later string comparisons and parsing from being weird
-static void trim_newline(char *s) {
-    if (s == NULL) return;
-    size_t len = strlen(s);
-    while (len > 0 && (s[len - 1] == '\n' || s[len - 1] == '\r')) {
-        s[len - 1] = '\0';
-        len--;
-    }
-}
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // tiny absolute value helper for floats
 // I just did this so I do not have to pull in the full math library
@@ -54,6 +48,14 @@ void Flower_init(Flower *f, const char *name, int num_petals) {
 
     f->seq_active = 0;
     f->elapsed_ms = 0;
+    f->seq_gap_ms = 200;
+
+    f->num_keys       = 0;
+    f->keys_playing   = 0;
+    f->key_next       = 0;
+    f->key_elapsed_ms = 0;
+    f->key_every_ms   = 0;
+    f->key_rounds     = 0;
 
     for (int i = 0; i < FLOWER_MAX_PETALS; i++) {
         f->petals[i].current_angle = f->close_angle;
@@ -70,7 +72,7 @@ static void Flower_startSeq1(Flower *f) {
     f->seq_active = 1;
     f->elapsed_ms = 0;
 
-    int gap = 200; // ms between petals
+    int gap = f->seq_gap_ms; // ms between petals (200 unless SET gap= changed it)
 
     for (int i = 0; i < f->num_petals; i++) {
         f->petals[i].delay_ms     = i * gap;
@@ -86,7 +88,7 @@ static void Flower_startSeq2(Flower *f) {
     f->seq_active = 2;
     f->elapsed_ms = 0;
 
-    int gap = 200;
+    int gap = f->seq_gap_ms;
     int left = 0;
     int right = f->num_petals - 1;
     int step_index = 0;
@@ -108,61 +110,374 @@ static void Flower_startSeq2(Flower *f) {
     }
 }
 
-// this takes a text command line like OPEN CLOSE SEQ1 SEQ2
-// trims it, cleans up whitespace and then updates the flower targets
+// commands used to be matched with a strcmp chain on a trimmed copy of the line
+// now the line is looked at where it sits, the first word is picked apart by length and
+// first byte and checked with one memcmp, and everything after that works with the opcode
 
-// OPEN means everybody heads toward the bloom angle
-// CLOSE means everybody heads toward the closed angle
-// SEQ1 and SEQ2 kick off the two fancier staggered animations i customized
-void Flower_applyCommand(Flower *f, const char *line) {
-    if (f == NULL || line == NULL) return;
+static const char *op_names[FLOWER_OP_COUNT] = {
+    "NONE", "OPEN", "CLOSE", "SEQ1", "SEQ2", "TERMINATE", "SET", "ANGLE", "KEYS"
+};
+
+// skips the same whitespace the old trimming did, without copying anything
+static void trim_slice(const char **s, size_t *len) {
+    while (*len > 0 && (**s == ' ' || **s == '\t')) {
+        (*s)++;
+        (*len)--;
+    }
+    while (*len > 0 && ((*s)[*len - 1] == '\n' || (*s)[*len - 1] == '\r')) {
+        (*len)--;
+    }
+}
+
+// length of the first word, up to a blank or the end
+static size_t word_len(const char *s, size_t len) {
+    size_t n = 0;
+    while (n < len && s[n] != ' ' && s[n] != '\t') n++;
+    return n;
+}
+
+int Flower_parseOpcode(const char *s, size_t len) {
+    if (s == NULL) return FLOWER_OP_NONE;
+    trim_slice(&s, &len);
+
+    size_t word = word_len(s, len);
+    int op = FLOWER_OP_NONE;
+    switch (word) {
+    case 3:
+        op = FLOWER_OP_SET;
+        break;
+    case 4:
+        if (s[0] == 'O') op = FLOWER_OP_OPEN;
+        else if (s[0] == 'K') op = FLOWER_OP_KEYS;
+        else if (s[0] == 'S' && s[3] == '1') op = FLOWER_OP_SEQ1;
+        else if (s[0] == 'S' && s[3] == '2') op = FLOWER_OP_SEQ2;
+        break;
+    case 5:
+        if (s[0] == 'C') op = FLOWER_OP_CLOSE;
+        else if (s[0] == 'A') op = FLOWER_OP_ANGLE;
+        break;
+    case 9:
+        op = FLOWER_OP_TERMINATE;
+        break;
+    }
+
+    // the switch only guessed, the full word still has to match
+    if (op != FLOWER_OP_NONE && memcmp(s, op_names[op], word) != 0) {
+        op = FLOWER_OP_NONE;
+    }
+    // and the plain commands take nothing after it
+    if (op != FLOWER_OP_NONE && !FLOWER_OP_HAS_ARGS(op) && word != len) {
+        op = FLOWER_OP_NONE;
+    }
+    return op;
+}
+
+// small number readers for the argument parsing, they move *p past what they read
+// and return 0 if there was no number there
+static int read_int(const char **p, const char *end, int *out) {
+    const char *q = *p;
+    int neg = 0;
+    if (q < end && (*q == '-' || *q == '+')) neg = (*q++ == '-');
+    if (q >= end || *q < '0' || *q > '9') return 0;
+    long v = 0;
+    while (q < end && *q >= '0' && *q <= '9') {
+        if (v < 100000000) v = v * 10 + (*q - '0');
+        q++;
+    }
+    *out = (int)(neg ? -v : v);
+    *p = q;
+    return 1;
+}
+
+static int read_float(const char **p, const char *end, float *out) {
+    int neg = (*p < end && **p == '-');
+    int whole;
+    if (!read_int(p, end, &whole)) return 0;
+    float v = (float)whole;
+    const char *q = *p;
+    if (q < end && *q == '.') {
+        float scale = neg ? -0.1f : 0.1f;
+        q++;
+        while (q < end && *q >= '0' && *q <= '9') {
+            v += scale * (float)(*q - '0');
+            scale *= 0.1f;
+            q++;
+        }
+    }
+    *out = v;
+    *p = q;
+    return 1;
+}
+
+// key=value, returns 1 and moves *p past the = if the word at *p starts with key
+static int read_key(const char **p, const char *end, const char *key) {
+    size_t klen = strlen(key);
+    if ((size_t)(end - *p) <= klen || memcmp(*p, key, klen) != 0 || (*p)[klen] != '=') return 0;
+    *p += klen + 1;
+    return 1;
+}
+
+static int angle_ok(float a) {
+    return a >= 0.0f && a <= 255.0f;   // status frames carry one byte per petal
+}
+
+// the argument part of SET / ANGLE / KEYS, returns 0 if anything in it is off
+static int parse_args(int op, const char *p, const char *end, FlowerCmd *c) {
+    c->petal = -1;
+
+    while (1) {
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (p >= end) break;
+
+        if (op == FLOWER_OP_SET) {
+            if (read_key(&p, end, "speed")) {
+                if (!read_float(&p, end, &c->speed) || c->speed <= 0.0f || c->speed > 1000.0f) return 0;
+                c->set |= FLOWER_SET_SPEED;
+            } else if (read_key(&p, end, "bloom")) {
+                if (!read_float(&p, end, &c->bloom) || !angle_ok(c->bloom)) return 0;
+                c->set |= FLOWER_SET_BLOOM;
+            } else if (read_key(&p, end, "close")) {
+                if (!read_float(&p, end, &c->close) || !angle_ok(c->close)) return 0;
+                c->set |= FLOWER_SET_CLOSE;
+            } else if (read_key(&p, end, "gap")) {
+                if (!read_int(&p, end, &c->gap_ms) || c->gap_ms < 0 || c->gap_ms > 60000) return 0;
+                c->set |= FLOWER_SET_GAP;
+            } else {
+                return 0;
+            }
+        } else if (op == FLOWER_OP_ANGLE) {
+            if (read_key(&p, end, "i")) {
+                if (end - p >= 3 && memcmp(p, "all", 3) == 0) {
+                    c->petal = -1;
+                    p += 3;
+                } else if (!read_int(&p, end, &c->petal) || c->petal < 0 ||
+                           c->petal >= FLOWER_MAX_PETALS) {
+                    return 0;
+                }
+            } else if (read_key(&p, end, "deg")) {
+                if (!read_float(&p, end, &c->angle) || !angle_ok(c->angle)) return 0;
+                c->has_angle = 1;
+            } else {
+                return 0;
+            }
+        } else {
+            if (read_key(&p, end, "every")) {
+                if (!read_int(&p, end, &c->every_ms) || c->every_ms <= 0) return 0;
+            } else if (read_key(&p, end, "times")) {
+                if (!read_int(&p, end, &c->times) || c->times < 0) return 0;
+            } else {
+                // <at_ms>:<deg>[,<deg>...]
+                if (c->num_keys == FLOWER_MAX_KEYS) return 0;
+                FlowerKey *k = &c->keys[c->num_keys];
+                if (!read_int(&p, end, &k->at_ms) || k->at_ms < 0) return 0;
+                if (c->num_keys > 0 && k->at_ms < c->keys[c->num_keys - 1].at_ms) return 0;
+                if (p >= end || *p++ != ':') return 0;
+                k->set = 0;
+                int n = 0;
+                while (1) {
+                    if (n == FLOWER_MAX_PETALS || !read_float(&p, end, &k->angle[n]) ||
+                        !angle_ok(k->angle[n])) {
+                        return 0;
+                    }
+                    k->set |= 1u << n;
+                    n++;
+                    if (p >= end || *p != ',') break;
+                    p++;
+                }
+                if (n == 1) {
+                    // one angle is for every petal
+                    for (int i = 1; i < FLOWER_MAX_PETALS; i++) k->angle[i] = k->angle[0];
+                    k->set = (1u << FLOWER_MAX_PETALS) - 1;
+                }
+                c->num_keys++;
+            }
+        }
+        // every argument has to end at a blank
+        if (p < end && *p != ' ' && *p != '\t') return 0;
+    }
+
+    if (op == FLOWER_OP_SET) return c->set != 0;
+    if (op == FLOWER_OP_ANGLE) return c->has_angle;
+    if (c->num_keys == 0) return 0;
+    // a repeating table has to be longer than its last keyframe or it would never get there
+    return c->every_ms == 0 || c->every_ms > c->keys[c->num_keys - 1].at_ms;
+}
+
+int Flower_parseCommand(const char *s, size_t len, FlowerCmd *out) {
+    out->op = FLOWER_OP_NONE;
+    if (s == NULL) return FLOWER_OP_NONE;
+
+    int op = Flower_parseOpcode(s, len);
+    if (FLOWER_OP_HAS_ARGS(op)) {
+        trim_slice(&s, &len);
+        size_t word = word_len(s, len);
+        out->set = 0;
+        out->has_angle = 0;
+        out->every_ms = 0;
+        out->times = 0;
+        out->num_keys = 0;
+        if (!parse_args(op, s + word, s + len, out)) op = FLOWER_OP_NONE;
+    }
+    out->op = op;
+    return op;
+}
+
+int Flower_splitStartTime(const char *s, size_t *len, int64_t *at_ms) {
+    size_t n = *len;
+    while (n > 0 && (s[n - 1] == '\n' || s[n - 1] == '\r' || s[n - 1] == ' ')) n--;
 
-    char buffer[128];
-    strncpy(buffer, line, sizeof(buffer) - 1);
-    buffer[sizeof(buffer) - 1] = '\0';
-    trim_newline(buffer);
+    size_t digits = 0;
+    while (digits < n && s[n - 1 - digits] >= '0' && s[n - 1 - digits] <= '9') digits++;
+    if (digits == 0 || digits > 18 || n - digits < 4) return 0;
 
-    char *p = buffer;
-    while (*p == ' ' || *p == '\t') p++;
+    const char *tag = s + n - digits - 4;
+    if (memcmp(tag, " @t=", 4) != 0) return 0;
 
-    if (*p == '\0') return;
+    int64_t v = 0;
+    for (size_t i = n - digits; i < n; i++) v = v * 10 + (s[i] - '0');
+    *at_ms = v;
+    *len = (size_t)(tag - s);
+    return 1;
+}
+
+const char *Flower_opName(int op) {
+    if (op < 0 || op >= FLOWER_OP_COUNT) return op_names[FLOWER_OP_NONE];
+    return op_names[op];
+}
 
-    if (strcmp(p, "OPEN") == 0) {
+// next keyframe (or the start of the next round) is due right now, apply it
+static void key_fire(Flower *f) {
+    if (f->key_next == f->num_keys) {
+        // end of a round, start over unless that was the last one
+        if (f->key_every_ms <= 0 || f->key_rounds == 0) {
+            f->keys_playing = 0;
+            return;
+        }
+        if (f->key_rounds > 0) f->key_rounds--;
+        f->key_next = 0;
+        f->key_elapsed_ms = 0;
+        return;
+    }
+
+    const FlowerKey *k = &f->keys[f->key_next++];
+    for (int i = 0; i < f->num_petals; i++) {
+        if (k->set & (1u << i)) {
+            f->petals[i].target_angle = k->angle[i];
+            f->petals[i].delay_ms = 0;
+        }
+    }
+}
+
+// ms until the keyframe table needs key_fire, -1 if there is no table playing
+static int key_wait_ms(const Flower *f) {
+    if (!f->keys_playing) return -1;
+    int at;
+    if (f->key_next < f->num_keys) {
+        at = f->keys[f->key_next].at_ms;
+    } else if (f->key_every_ms > 0 && f->key_rounds != 0) {
+        at = f->key_every_ms;
+    } else {
+        return 0;   // fires once more just to stop
+    }
+    int wait = at - f->key_elapsed_ms;
+    return (wait > 0) ? wait : 0;
+}
+
+static void keys_fire_due(Flower *f) {
+    while (key_wait_ms(f) == 0) {
+        key_fire(f);
+    }
+}
+
+// OPEN means everybody heads toward the bloom angle
+// CLOSE means everybody heads toward the closed angle (TERMINATE too, that is what
+// every caller did with it anyway before shutting down)
+// SEQ1 and SEQ2 kick off the two fancier staggered animations i customized
+// any of them takes over from a keyframe table that is still playing
+void Flower_applyOpcode(Flower *f, int op) {
+    if (f == NULL) return;
+    if (op == FLOWER_OP_NONE || FLOWER_OP_HAS_ARGS(op)) return;
+
+    f->keys_playing = 0;
+
+    switch (op) {
+    case FLOWER_OP_OPEN:
         f->seq_active = 0;
         f->elapsed_ms = 0;
         for (int i = 0; i < f->num_petals; i++) {
             f->petals[i].delay_ms     = 0;
             f->petals[i].target_angle = f->bloom_angle;
         }
-    }
-    else if (strcmp(p, "CLOSE") == 0) {
+        break;
+    case FLOWER_OP_CLOSE:
+    case FLOWER_OP_TERMINATE:
         f->seq_active = 0;
         f->elapsed_ms = 0;
         for (int i = 0; i < f->num_petals; i++) {
             f->petals[i].delay_ms     = 0;
             f->petals[i].target_angle = f->close_angle;
         }
-    }
-    else if (strcmp(p, "SEQ1") == 0) {
+        break;
+    case FLOWER_OP_SEQ1:
         Flower_startSeq1(f);
-    }
-    else if (strcmp(p, "SEQ2") == 0) {
+        break;
+    case FLOWER_OP_SEQ2:
         Flower_startSeq2(f);
+        break;
     }
-    else {
-        // unknown commands are just ignored so the client does not explode!
+}
+
+void Flower_applyCmd(Flower *f, const FlowerCmd *c) {
+    if (f == NULL || c == NULL) return;
+
+    switch (c->op) {
+    case FLOWER_OP_SET:
+        if (c->set & FLOWER_SET_SPEED) f->speed_deg_per_sec = c->speed;
+        if (c->set & FLOWER_SET_BLOOM) f->bloom_angle = c->bloom;
+        if (c->set & FLOWER_SET_CLOSE) f->close_angle = c->close;
+        if (c->set & FLOWER_SET_GAP)   f->seq_gap_ms = c->gap_ms;
+        break;
+    case FLOWER_OP_ANGLE:
+        for (int i = 0; i < f->num_petals; i++) {
+            if (c->petal < 0 || c->petal == i) {
+                f->petals[i].target_angle = c->angle;
+                f->petals[i].delay_ms = 0;
+            }
+        }
+        break;
+    case FLOWER_OP_KEYS:
+        // the table takes over from whatever sequence was running
+        f->seq_active = 0;
+        f->elapsed_ms = 0;
+        for (int i = 0; i < f->num_petals; i++) f->petals[i].delay_ms = 0;
+        memcpy(f->keys, c->keys, sizeof(FlowerKey) * (size_t)c->num_keys);
+        f->num_keys       = c->num_keys;
+        f->key_every_ms   = c->every_ms;
+        f->key_rounds     = (c->times > 0) ? c->times - 1 : -1;
+        f->key_next       = 0;
+        f->key_elapsed_ms = 0;
+        f->keys_playing   = 1;
+        keys_fire_due(f);   // anything at 0 ms starts right now
+        break;
+    default:
+        Flower_applyOpcode(f, c->op);
+        break;
     }
 }
 
+void Flower_applyCommand(Flower *f, const char *line) {
+    if (f == NULL || line == NULL) return;
+    FlowerCmd c;
+    Flower_parseCommand(line, strlen(line), &c);
+    Flower_applyCmd(f, &c);
+}
+
 // below is the little physics tick for the flower mwahahahaha the cool part
 
 // dt_ms is jsut how many milliseconds passed since the last update call
 // it uses the speed in degrees per second and moves each petal toward its target
 // if a sequence is active it also keeps track of elapsed time to honor the per petal delays
-void Flower_update(Flower *f, int dt_ms) {
-    if (f == NULL) return;
-    if (dt_ms <= 0) return;
-
+static void flower_step(Flower *f, int dt_ms) {
     if (f->seq_active != 0) {
         f->elapsed_ms += dt_ms;
     }
@@ -196,6 +511,294 @@ void Flower_update(Flower *f, int dt_ms) {
     }
 }
 
+// a keyframe table splits the step at every keyframe so new targets land exactly on time,
+// without one playing this is a single flower_step like it always was
+void Flower_update(Flower *f, int dt_ms) {
+    if (f == NULL) return;
+    if (dt_ms <= 0) return;
+
+    while (dt_ms > 0) {
+        int wait = key_wait_ms(f);
+        if (wait < 0 || wait > dt_ms) {
+            flower_step(f, dt_ms);
+            if (f->keys_playing) f->key_elapsed_ms += dt_ms;
+            return;
+        }
+        if (wait > 0) {
+            flower_step(f, wait);
+            f->key_elapsed_ms += wait;
+            dt_ms -= wait;
+        }
+        keys_fire_due(f);
+    }
+}
+
+// the batch version of the tick above for hosts running lots of flowers
+// same math as Flower_update but written without any branches in the inner loop so it turns into
+// plain vector compare/select code, the if/else ladder above collapses to
+//   diff >  step  -> cur + step
+//   diff < -step  -> cur - step
+//   diff == 0     -> cur       (same value as tgt, this just keeps the sign of a zero the same)
+//   otherwise     -> tgt
+// and a petal that is waiting on its delay (or is past num_petals) just keeps cur
+// gcc will not if-convert those float compares on its own without -fno-trapping-math,
+// so on x86 the rows go through sse2 directly and everything else gets the scalar loop
+
+int FlowerBatch_init(FlowerBatch *b, int cap) {
+    memset(b, 0, sizeof(*b));
+    if (cap < 1) cap = 1;
+    cap = (cap + 7) & ~7;   // keeps every petal row starting on a 32 byte boundary
+    size_t rows = (size_t)FLOWER_MAX_PETALS * (size_t)cap;
+
+    b->cap        = cap;
+    b->current    = calloc(rows, sizeof(float));
+    b->target     = calloc(rows, sizeof(float));
+    b->delay_ms   = calloc(rows, sizeof(int));
+    b->speed      = calloc((size_t)cap, sizeof(float));
+    b->step       = calloc((size_t)cap, sizeof(float));
+    b->num_petals = calloc((size_t)cap, sizeof(int));
+    b->seq_active = calloc((size_t)cap, sizeof(int));
+    b->elapsed_ms = calloc((size_t)cap, sizeof(int));
+
+    if (!b->current || !b->target || !b->delay_ms || !b->speed || !b->step ||
+        !b->num_petals || !b->seq_active || !b->elapsed_ms) {
+        FlowerBatch_free(b);
+        return 0;
+    }
+    return 1;
+}
+
+void FlowerBatch_free(FlowerBatch *b) {
+    free(b->current);
+    free(b->target);
+    free(b->delay_ms);
+    free(b->speed);
+    free(b->step);
+    free(b->num_petals);
+    free(b->seq_active);
+    free(b->elapsed_ms);
+    memset(b, 0, sizeof(*b));
+}
+
+void FlowerBatch_load(FlowerBatch *b, int i, const Flower *f) {
+    if (b == NULL || f == NULL || i < 0 || i >= b->cap) return;
+
+    for (int p = 0; p < FLOWER_MAX_PETALS; p++) {
+        b->current[p * b->cap + i]  = f->petals[p].current_angle;
+        b->target[p * b->cap + i]   = f->petals[p].target_angle;
+        b->delay_ms[p * b->cap + i] = f->petals[p].delay_ms;
+    }
+    b->speed[i]      = f->speed_deg_per_sec;
+    b->num_petals[i] = f->num_petals;
+    b->seq_active[i] = f->seq_active;
+    b->elapsed_ms[i] = f->elapsed_ms;
+    if (i >= b->count) b->count = i + 1;
+}
+
+void FlowerBatch_store(const FlowerBatch *b, int i, Flower *f) {
+    if (b == NULL || f == NULL || i < 0 || i >= b->count) return;
+
+    for (int p = 0; p < FLOWER_MAX_PETALS; p++) {
+        f->petals[p].current_angle = b->current[p * b->cap + i];
+        f->petals[p].target_angle  = b->target[p * b->cap + i];
+        f->petals[p].delay_ms      = b->delay_ms[p * b->cap + i];
+    }
+    f->elapsed_ms = b->elapsed_ms[i];
+}
+
+#ifdef __SSE2__
+// four flowers of one petal row at a time
+// sse2 has no blend so every select is the usual and / andnot / or
+static inline __m128 batch_select(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static int batch_row_sse2(int p, int n, float *cur_row, const float *tgt_row, const int *dly_row,
+                          const float *step, const int *num_petals, const int *seq_active,
+                          const int *elapsed_ms) {
+    const __m128  zero  = _mm_setzero_ps();
+    const __m128  sign  = _mm_set1_ps(-0.0f);
+    const __m128i izero = _mm_setzero_si128();
+    const __m128i petal = _mm_set1_epi32(p);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128 cur  = _mm_loadu_ps(cur_row + i);
+        __m128 tgt  = _mm_loadu_ps(tgt_row + i);
+        __m128 st   = _mm_loadu_ps(step + i);
+        __m128 diff = _mm_sub_ps(tgt, cur);
+
+        __m128 moved = batch_select(_mm_cmpeq_ps(diff, zero), cur, tgt);
+        moved = batch_select(_mm_cmplt_ps(diff, _mm_xor_ps(st, sign)), _mm_sub_ps(cur, st), moved);
+        moved = batch_select(_mm_cmpgt_ps(diff, st), _mm_add_ps(cur, st), moved);
+
+        __m128i seq     = _mm_loadu_si128((const __m128i *)(seq_active + i));
+        __m128i elapsed = _mm_loadu_si128((const __m128i *)(elapsed_ms + i));
+        __m128i delay   = _mm_loadu_si128((const __m128i *)(dly_row + i));
+        __m128i petals  = _mm_loadu_si128((const __m128i *)(num_petals + i));
+
+        __m128i waiting = _mm_andnot_si128(_mm_cmpeq_epi32(seq, izero),
+                                           _mm_cmplt_epi32(elapsed, delay));
+        __m128i active  = _mm_andnot_si128(waiting, _mm_cmpgt_epi32(petals, petal));
+        __m128  mask    = _mm_and_ps(_mm_castsi128_ps(active), _mm_cmpgt_ps(st, zero));
+
+        _mm_storeu_ps(cur_row + i, batch_select(mask, moved, cur));
+    }
+    return i;
+}
+#endif
+
+void FlowerBatch_update(FlowerBatch *b, int dt_ms) {
+    if (b == NULL) return;
+    if (dt_ms <= 0) return;
+
+    const int n = b->count;
+    const int cap = b->cap;
+    const float dt_sec = (float)dt_ms / 1000.0f;
+
+    // per flower part first, the sequence clock and how far this flower may move
+    // (Flower_update bumps elapsed_ms before it looks at the step so this does too)
+    for (int i = 0; i < n; i++) {
+        b->elapsed_ms[i] += (b->seq_active[i] != 0) ? dt_ms : 0;
+        b->step[i] = b->speed[i] * dt_sec;
+    }
+
+    // then one petal row at a time, every flower in a row is independent
+    for (int p = 0; p < FLOWER_MAX_PETALS; p++) {
+        float       *cur_row = b->current + (size_t)p * cap;
+        const float *tgt_row = b->target + (size_t)p * cap;
+        const int   *dly_row = b->delay_ms + (size_t)p * cap;
+        int i = 0;
+
+#ifdef __SSE2__
+        i = batch_row_sse2(p, n, cur_row, tgt_row, dly_row,
+                           b->step, b->num_petals, b->seq_active, b->elapsed_ms);
+#endif
+        // whatever is left over (or everything without sse2), same selects one flower at a time
+        for (; i < n; i++) {
+            float cur  = cur_row[i];
+            float tgt  = tgt_row[i];
+            float st   = b->step[i];
+            float diff = tgt - cur;
+
+            float moved = (diff == 0.0f) ? cur : tgt;
+            moved = (diff < -st) ? cur - st : moved;
+            moved = (diff > st) ? cur + st : moved;
+
+            int waiting = (b->seq_active[i] != 0) && (b->elapsed_ms[i] < dly_row[i]);
+            int active  = (p < b->num_petals[i]) && !waiting && (st > 0.0f);
+            cur_row[i] = active ? moved : cur;
+        }
+    }
+}
+
+// closed form version of the motion, used to know when something will happen next
+// (so idle flowers can just sleep) and to compute a pose without stepping to it
+// this is the ideal continuous path, Flower_update gets there in dt sized steps so the two can
+// be a fraction of a step apart while a petal is moving but always agree where it ends up
+
+// how long this petal still waits on its sequence delay
+static int petal_wait_ms(const Flower *f, int i) {
+    if (f->seq_active == 0) return 0;
+    int wait = f->petals[i].delay_ms - f->elapsed_ms;
+    return (wait > 0) ? wait : 0;
+}
+
+// the straight line part, good up to the next keyframe
+static float angle_at_plain(const Flower *f, int petal, int t_ms) {
+    const Petal *p = &f->petals[petal];
+    float diff = p->target_angle - p->current_angle;
+    int moving_ms = t_ms - petal_wait_ms(f, petal);
+    if (diff == 0.0f || moving_ms <= 0 || f->speed_deg_per_sec <= 0.0f) {
+        return p->current_angle;
+    }
+
+    float travel = f->speed_deg_per_sec * ((float)moving_ms / 1000.0f);
+    if (travel >= myabsf(diff)) return p->target_angle;
+    return (diff > 0.0f) ? p->current_angle + travel : p->current_angle - travel;
+}
+
+// jump t_ms along the straight lines, t_ms must not cross a keyframe
+static void advance_plain(Flower *f, int t_ms) {
+    float angles[FLOWER_MAX_PETALS];
+    for (int i = 0; i < f->num_petals; i++) {
+        angles[i] = angle_at_plain(f, i, t_ms);
+    }
+    for (int i = 0; i < f->num_petals; i++) {
+        f->petals[i].current_angle = angles[i];
+    }
+    if (f->seq_active != 0) {
+        f->elapsed_ms += t_ms;
+    }
+}
+
+float Flower_angleAt(const Flower *f, int petal, int t_ms) {
+    if (f == NULL || petal < 0 || petal >= f->num_petals) return 0.0f;
+
+    int wait = key_wait_ms(f);
+    if (wait < 0 || wait >= t_ms) return angle_at_plain(f, petal, t_ms);
+
+    // keyframes on the way change the targets, walk a copy through them
+    Flower copy = *f;
+    Flower_advance(&copy, t_ms);
+    return copy.petals[petal].current_angle;
+}
+
+int Flower_nextEventTime(const Flower *f) {
+    if (f == NULL) return -1;
+
+    // the next keyframe is always an event, even if the petals are standing still
+    int next = key_wait_ms(f);
+    if (f->speed_deg_per_sec <= 0.0f) return next;
+
+    for (int i = 0; i < f->num_petals; i++) {
+        float diff = myabsf(f->petals[i].target_angle - f->petals[i].current_angle);
+        if (diff == 0.0f) continue;
+
+        // either it starts moving after its delay or it is already moving and will arrive
+        int wait = petal_wait_ms(f, i);
+        int when = wait;
+        if (wait == 0) {
+            float arrive = diff * 1000.0f / f->speed_deg_per_sec;
+            when = (int)arrive;
+            if ((float)when < arrive) when++;   // round up so the petal is really there
+        }
+        if (next < 0 || when < next) next = when;
+    }
+    return next;
+}
+
+void Flower_advance(Flower *f, int t_ms) {
+    if (f == NULL || t_ms <= 0) return;
+
+    // same splitting at keyframes as Flower_update
+    while (t_ms > 0) {
+        int wait = key_wait_ms(f);
+        if (wait < 0 || wait > t_ms) {
+            advance_plain(f, t_ms);
+            if (f->keys_playing) f->key_elapsed_ms += t_ms;
+            return;
+        }
+        if (wait > 0) {
+            advance_plain(f, wait);
+            f->key_elapsed_ms += wait;
+            t_ms -= wait;
+        }
+        keys_fire_due(f);
+    }
+}
+
+// decide if the flower is idle or moving by checking how far each petal is from its target
+int Flower_isMoving(const Flower *f) {
+    for (int i = 0; i < f->num_petals; i++) {
+        float diff = f->petals[i].target_angle - f->petals[i].current_angle;
+        if (myabsf(diff) > 0.5f) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 // this builds a status line that the client can send back to the server
 // the format is text based so it is easy to log and debug
 // includes flower name a simple state and the current petal angles
@@ -204,15 +807,7 @@ void Flower_buildStatus(const Flower *f, char *out, size_t out_size) {
 
     out[0] = '\0';
 
-    // decide if the flower is idle or moving by checking how far each petal is from its target
-    const char *state = "IDLE";
-    for (int i = 0; i < f->num_petals; i++) {
-        float diff = f->petals[i].target_angle - f->petals[i].current_angle;
-        if (myabsf(diff) > 0.5f) {
-            state = "MOVING";
-            break;
-        }
-    }
+    const char *state = Flower_isMoving(f) ? "MOVING" : "IDLE";
 
     int written = snprintf(out, out_size,
         "STATUS name=%s state=%s petal_angles=",
@@ -251,4 +846,296 @@ void Flower_buildStatus(const Flower *f, char *out, size_t out_size) {
     } else {
         out[out_size - 1] = '\0';
     }
-}
\ No newline at end of file
+}
+
+// below is the binary version of the status message
+// the text line is great for reading but at 10 times a second per flower it is mostly
+// snprintf work and bytes on the wire, a frame is 8 bytes of header plus one byte per petal
+
+size_t Flower_frameLength(const unsigned char *in, size_t avail) {
+    if (in == NULL || avail < FLOWER_FRAME_HEADER) return 0;
+    return (size_t)in[2];
+}
+
+size_t Flower_encodeCommand(int op, unsigned char *out, size_t out_size) {
+    if (out == NULL || out_size < FLOWER_FRAME_HEADER + 1) return 0;
+    if (op <= FLOWER_OP_NONE || FLOWER_OP_HAS_ARGS(op)) return 0;
+    out[0] = FLOWER_FRAME_MAGIC;
+    out[1] = FLOWER_FRAME_CMD;
+    out[2] = FLOWER_FRAME_HEADER + 1;
+    out[3] = (unsigned char)op;
+    return FLOWER_FRAME_HEADER + 1;
+}
+
+int Flower_decodeCommand(const unsigned char *in, size_t len) {
+    if (in == NULL || len != FLOWER_FRAME_HEADER + 1) return FLOWER_OP_NONE;
+    if (in[0] != FLOWER_FRAME_MAGIC || in[1] != FLOWER_FRAME_CMD || in[2] != len) return FLOWER_OP_NONE;
+    if (in[3] >= FLOWER_OP_COUNT || FLOWER_OP_HAS_ARGS(in[3])) return FLOWER_OP_NONE;
+    return in[3];
+}
+
+size_t Flower_encodeStatus(const Flower *f, uint32_t id, unsigned char *out, size_t out_size) {
+    if (f == NULL || out == NULL) return 0;
+
+    int num = f->num_petals;
+    size_t len = FLOWER_FRAME_HEADER + 5 + (size_t)num;
+    if (out_size < len) return 0;
+
+    out[0] = FLOWER_FRAME_MAGIC;
+    out[1] = FLOWER_FRAME_STATUS;
+    out[2] = (unsigned char)len;
+    out[3] = (unsigned char)((num << 4) | (Flower_isMoving(f) ? 1 : 0));
+    out[4] = (unsigned char)(id >> 24);
+    out[5] = (unsigned char)(id >> 16);
+    out[6] = (unsigned char)(id >> 8);
+    out[7] = (unsigned char)id;
+
+    // same rounding as the text line so both formats always agree
+    for (int i = 0; i < num; i++) {
+        int ang = (int)(f->petals[i].current_angle + 0.5f);
+        if (ang < 0) ang = 0;
+        if (ang > 255) ang = 255;
+        out[8 + i] = (unsigned char)ang;
+    }
+    return len;
+}
+
+int Flower_decodeStatus(const unsigned char *in, size_t len, FlowerStatusFrame *out) {
+    if (in == NULL || out == NULL || len < FLOWER_FRAME_HEADER + 5) return 0;
+    if (in[0] != FLOWER_FRAME_MAGIC || in[1] != FLOWER_FRAME_STATUS) return 0;
+
+    int num = in[3] >> 4;
+    if (num < 1 || num > FLOWER_MAX_PETALS) return 0;
+    if (in[2] != len || len != FLOWER_FRAME_HEADER + 5 + (size_t)num) return 0;
+
+    out->moving     = in[3] & 1;
+    out->num_petals = num;
+    out->id = ((uint32_t)in[4] << 24) | ((uint32_t)in[5] << 16) |
+              ((uint32_t)in[6] << 8)  |  (uint32_t)in[7];
+    memcpy(out->angles, in + 8, (size_t)num);
+    return 1;
+}
+
+void Flower_formatStatusFrame(const FlowerStatusFrame *fr, const char *name, char *out, size_t out_size) {
+    if (fr == NULL || out == NULL || out_size == 0) return;
+
+    int written = snprintf(out, out_size, "STATUS name=%s state=%s petal_angles=",
+                           (name != NULL && name[0] != '\0') ? name : "noname",
+                           fr->moving ? "MOVING" : "IDLE");
+    if (written < 0 || (size_t)written >= out_size) return;
+
+    size_t used = (size_t)written;
+    for (int i = 0; i < fr->num_petals && used < out_size; i++) {
+        int n = snprintf(out + used, out_size - used,
+                         (i == fr->num_petals - 1) ? "%d" : "%d,", fr->angles[i]);
+        if (n < 0) break;
+        used += (size_t)n;
+    }
+}
+
+// reads the state=... value, it is the only word we care about
+static int parse_state_word(const char *line, int *moving) {
+    const char *st = strstr(line, " state=");
+    if (st == NULL) return 0;
+    st += 7;
+    if (strncmp(st, "MOVING", 6) == 0) *moving = 1;
+    else if (strncmp(st, "IDLE", 4) == 0) *moving = 0;
+    else return 0;
+    return 1;
+}
+
+static uint8_t clamp_angle(long v) {
+    if (v < 0) return 0;
+    if (v > 255) return 255;
+    return (uint8_t)v;
+}
+
+int Flower_parseStatusLine(const char *line, FlowerStatusFrame *out) {
+    if (line == NULL || out == NULL) return 0;
+    if (strncmp(line, "STATUS", 6) != 0) return 0;
+
+    FlowerStatusFrame fr;
+    memset(&fr, 0, sizeof(fr));
+    if (!parse_state_word(line, &fr.moving)) return 0;
+
+    const char *p = strstr(line, " petal_angles=");
+    if (p == NULL) return 0;
+    p += 14;
+
+    while (fr.num_petals < FLOWER_MAX_PETALS) {
+        char *end;
+        long v = strtol(p, &end, 10);
+        if (end == p) break;
+        fr.angles[fr.num_petals++] = clamp_angle(v);
+        if (*end != ',') break;
+        p = end + 1;
+    }
+    if (fr.num_petals == 0) return 0;
+
+    *out = fr;
+    return 1;
+}
+
+// the client side of change driven reporting
+// rounding matches the status line so "changed" means the number the server would see changed
+void FlowerReporter_init(FlowerReporter *r, int threshold_deg, int heartbeat_ms) {
+    if (r == NULL) return;
+    memset(r, 0, sizeof(*r));
+    r->threshold_deg = (threshold_deg < 1) ? 1 : threshold_deg;
+    r->heartbeat_ms  = heartbeat_ms;
+}
+
+int FlowerReporter_step(FlowerReporter *r, const Flower *f, int dt_ms, unsigned *mask) {
+    if (r == NULL || f == NULL) return FLOWER_REPORT_NONE;
+
+    int moving = Flower_isMoving(f);
+    uint8_t now[FLOWER_MAX_PETALS];
+    for (int i = 0; i < f->num_petals; i++) {
+        now[i] = clamp_angle((long)(f->petals[i].current_angle + 0.5f));
+    }
+
+    r->since_full_ms += dt_ms;
+
+    // first report, heartbeat due or the flower just started / stopped moving means a full status
+    // the stop case matters because the last few degrees can be under the threshold
+    if (!r->has_sent || moving != r->moving ||
+        (r->heartbeat_ms > 0 && r->since_full_ms >= r->heartbeat_ms)) {
+        r->has_sent = 1;
+        r->moving = moving;
+        r->since_full_ms = 0;
+        memcpy(r->angles, now, (size_t)f->num_petals);
+        return FLOWER_REPORT_FULL;
+    }
+
+    unsigned changed = 0;
+    for (int i = 0; i < f->num_petals; i++) {
+        int d = (int)now[i] - (int)r->angles[i];
+        if (d >= r->threshold_deg || -d >= r->threshold_deg) {
+            changed |= 1u << i;
+            r->angles[i] = now[i];
+        }
+    }
+
+    if (changed == 0) return FLOWER_REPORT_NONE;
+    if (mask != NULL) *mask = changed;
+    return FLOWER_REPORT_DELTA;
+}
+
+void Flower_buildDelta(const Flower *f, unsigned mask, char *out, size_t out_size) {
+    if (f == NULL || out == NULL || out_size == 0) return;
+
+    int written = snprintf(out, out_size, "DELTA name=%s state=%s petals=",
+                           (f->name[0] != '\0') ? f->name : "noname",
+                           Flower_isMoving(f) ? "MOVING" : "IDLE");
+    if (written < 0 || (size_t)written >= out_size) {
+        out[out_size - 1] = '\0';
+        return;
+    }
+
+    size_t used = (size_t)written;
+    int first = 1;
+    for (int i = 0; i < f->num_petals; i++) {
+        if (!(mask & (1u << i))) continue;
+        int n = snprintf(out + used, out_size - used, first ? "%d:%d" : ",%d:%d",
+                         i, (int)(f->petals[i].current_angle + 0.5f));
+        if (n < 0 || used + (size_t)n >= out_size) {
+            out[out_size - 1] = '\0';
+            return;
+        }
+        used += (size_t)n;
+        first = 0;
+    }
+
+    if (used + 1 < out_size) {
+        out[used] = '\n';
+        out[used + 1] = '\0';
+    }
+}
+
+size_t Flower_encodeDelta(const Flower *f, uint32_t id, unsigned mask, unsigned char *out, size_t out_size) {
+    if (f == NULL || out == NULL) return 0;
+
+    int num = f->num_petals;
+    mask &= (1u << num) - 1;
+
+    size_t len = FLOWER_FRAME_HEADER + 6;
+    for (int i = 0; i < num; i++) {
+        if (mask & (1u << i)) len++;
+    }
+    if (out_size < len) return 0;
+
+    out[0] = FLOWER_FRAME_MAGIC;
+    out[1] = FLOWER_FRAME_DELTA;
+    out[2] = (unsigned char)len;
+    out[3] = (unsigned char)((num << 4) | (Flower_isMoving(f) ? 1 : 0));
+    out[4] = (unsigned char)(id >> 24);
+    out[5] = (unsigned char)(id >> 16);
+    out[6] = (unsigned char)(id >> 8);
+    out[7] = (unsigned char)id;
+    out[8] = (unsigned char)mask;
+
+    size_t pos = 9;
+    for (int i = 0; i < num; i++) {
+        if (mask & (1u << i)) {
+            out[pos++] = clamp_angle((long)(f->petals[i].current_angle + 0.5f));
+        }
+    }
+    return len;
+}
+
+int Flower_applyDeltaFrame(const unsigned char *in, size_t len, FlowerStatusFrame *snap) {
+    if (in == NULL || snap == NULL || snap->num_petals == 0) return 0;
+    if (len < FLOWER_FRAME_HEADER + 6) return 0;
+    if (in[0] != FLOWER_FRAME_MAGIC || in[1] != FLOWER_FRAME_DELTA || in[2] != len) return 0;
+
+    int num = in[3] >> 4;
+    if (num != snap->num_petals) return 0;
+
+    uint32_t id = ((uint32_t)in[4] << 24) | ((uint32_t)in[5] << 16) |
+                  ((uint32_t)in[6] << 8)  |  (uint32_t)in[7];
+    if (id != snap->id) return 0;
+
+    unsigned mask = in[8];
+    size_t pos = 9;
+    for (int i = 0; i < num; i++) {
+        if (!(mask & (1u << i))) continue;
+        if (pos >= len) return 0;
+        snap->angles[i] = in[pos++];
+    }
+    if (pos != len) return 0;
+
+    snap->moving = in[3] & 1;
+    return 1;
+}
+
+int Flower_applyDeltaLine(const char *line, FlowerStatusFrame *snap) {
+    if (line == NULL || snap == NULL || snap->num_petals == 0) return 0;
+    if (strncmp(line, "DELTA", 5) != 0) return 0;
+
+    int moving;
+    if (!parse_state_word(line, &moving)) return 0;
+
+    const char *p = strstr(line, " petals=");
+    if (p == NULL) return 0;
+    p += 8;
+
+    // parse everything first so a broken line does not leave a half applied snapshot
+    uint8_t angles[FLOWER_MAX_PETALS];
+    memcpy(angles, snap->angles, sizeof(angles));
+    while (*p != '\0') {
+        char *end;
+        long idx = strtol(p, &end, 10);
+        if (end == p || *end != ':' || idx < 0 || idx >= snap->num_petals) return 0;
+        p = end + 1;
+        long v = strtol(p, &end, 10);
+        if (end == p) return 0;
+        angles[idx] = clamp_angle(v);
+        p = end;
+        if (*p == ',') p++;
+        else break;
+    }
+
+    memcpy(snap->angles, angles, sizeof(angles));
+    snap->moving = moving;
+    return 1;
+}
@@ -5,8 +5,11 @@
 #define FLOWER_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #define FLOWER_MAX_PETALS 8
+#define FLOWER_MAX_KEYS   16    // keyframes in one KEYS table
+#define FLOWER_CMD_MAX    512   // longest command line a flower takes (a full KEYS table fits)
 
 typedef struct {
     float current_angle;
@@ -14,6 +17,13 @@ typedef struct {
     int   delay_ms;      // sequence start delay for this petal
 } Petal;
 
+// one keyframe, at at_ms into the table every petal with its bit in set gets a new target
+typedef struct {
+    int      at_ms;
+    unsigned set;
+    float    angle[FLOWER_MAX_PETALS];
+} FlowerKey;
+
 typedef struct {
     char  name[32];
     int   num_petals;
@@ -26,20 +36,236 @@ typedef struct {
 
     int   seq_active;        // 0 = none, 1 = SEQ1, 2 = SEQ2
     int   elapsed_ms;        // used for delay_ms in sequences
+    int   seq_gap_ms;        // ms between petals in SEQ1 / SEQ2
+
+    // keyframe table uploaded with KEYS, the flower plays it by itself from then on
+    FlowerKey keys[FLOWER_MAX_KEYS];
+    int   num_keys;
+    int   keys_playing;
+    int   key_next;          // next keyframe, num_keys means waiting for the next round
+    int   key_elapsed_ms;    // time into the current round
+    int   key_every_ms;      // round length, 0 plays the table once
+    int   key_rounds;        // rounds left after this one, -1 forever
 } Flower;
 
 // initialize a flower with a name and number of petals
 void Flower_init(Flower *f, const char *name, int num_petals);
 
-// apply a command string: "OPEN", "CLOSE", "SEQ1", or "SEQ2"
+// commands as small numbers, parsed once and then passed around (and sent) as these
+#define FLOWER_OP_NONE       0   // anything that is not a flower command
+#define FLOWER_OP_OPEN       1
+#define FLOWER_OP_CLOSE      2
+#define FLOWER_OP_SEQ1       3
+#define FLOWER_OP_SEQ2       4
+#define FLOWER_OP_TERMINATE  5   // moves the petals like CLOSE
+#define FLOWER_OP_SET        6   // from here on the commands carry arguments
+#define FLOWER_OP_ANGLE      7
+#define FLOWER_OP_KEYS       8
+#define FLOWER_OP_COUNT      9
+
+#define FLOWER_OP_HAS_ARGS(op) ((op) >= FLOWER_OP_SET)
+
+// parameterized commands, all arguments are key=value except the keyframes
+//   SET [speed=<deg/s>] [bloom=<deg>] [close=<deg>] [gap=<ms>]
+//       speed applies right away, bloom / close to the next OPEN / CLOSE, gap to SEQ1 / SEQ2
+//   ANGLE [i=<petal>|i=all] deg=<deg>
+//       one petal (or all of them) heads for deg, the rest keep doing what they do
+//   KEYS [every=<ms> [times=<n>]] <at_ms>:<deg>[,<deg>...] ...
+//       keyframe table the flower plays on its own, at at_ms into the table the listed petals
+//       get new targets (one angle means every petal), every restarts the table, times caps
+//       the rounds (0 or none = forever), OPEN / CLOSE / SEQ* / TERMINATE stop it
+//   e.g. KEYS every=6000 0:80 2000:5,80,5,80 4000:5
+#define FLOWER_SET_SPEED  0x1
+#define FLOWER_SET_BLOOM  0x2
+#define FLOWER_SET_CLOSE  0x4
+#define FLOWER_SET_GAP    0x8
+
+typedef struct {
+    int       op;
+    unsigned  set;           // SET, FLOWER_SET_* bits for the fields that were given
+    float     speed;
+    float     bloom;
+    float     close;
+    int       gap_ms;
+    int       petal;         // ANGLE, -1 for all
+    float     angle;
+    int       has_angle;     // ANGLE, deg= was given (set is only for SET)
+    int       every_ms;      // KEYS
+    int       times;
+    int       num_keys;
+    FlowerKey keys[FLOWER_MAX_KEYS];
+} FlowerCmd;
+
+// opcode for the command in s[0..len), works in place on a receive buffer (no nul needed),
+// leading blanks and a trailing \r / \n are skipped, FLOWER_OP_NONE if it is not a command
+// for the commands with arguments this only looks at the first word
+int Flower_parseOpcode(const char *s, size_t len);
+
+// full parse including the arguments, same rules as above
+// returns the opcode (also left in out->op), FLOWER_OP_NONE if it is not a command or malformed
+int Flower_parseCommand(const char *s, size_t len, FlowerCmd *out);
+
+// any command can end in " @t=<server_ms>", a start time on the servers CLOCK_MONOTONIC
+// (see clocksync.h), the flower holds it until then so a whole garden starts together
+// returns 1 and sets *at_ms if s[0..*len) has one, *len is cut down to the command in front of it
+int Flower_splitStartTime(const char *s, size_t *len, int64_t *at_ms);
+
+// "OPEN", "CLOSE", ... for printing, "NONE" for anything else
+const char *Flower_opName(int op);
+
+// the commands without arguments, anything else is ignored
+void Flower_applyOpcode(Flower *f, int op);
+
+void Flower_applyCmd(Flower *f, const FlowerCmd *c);
+
+// apply a command string, any of the above
 void Flower_applyCommand(Flower *f, const char *line);
 
 // move petals toward their targets by dt_ms milliseconds
 void Flower_update(Flower *f, int dt_ms);
 
+// 1 if any petal is still more than half a degree away from its target
+int Flower_isMoving(const Flower *f);
+
+// closed form motion, a petal sits still until its delay has passed and then moves at
+// speed_deg_per_sec in a straight line until it reaches its target, so its pose at any time
+// can be worked out directly instead of ticking there
+// all times are ms from the flowers current state
+
+// angle petal will be at t_ms from now
+float Flower_angleAt(const Flower *f, int petal, int t_ms);
+
+// ms until the next thing happens (a petal starts moving or reaches its target),
+// -1 if nothing will ever happen without a new command
+int Flower_nextEventTime(const Flower *f);
+
+// jump the whole flower t_ms forward along those trajectories in one go
+void Flower_advance(Flower *f, int t_ms);
+
+// batch stepping for hosts that run a lot of flowers, same motion as Flower_update
+// but the state lives in structure of arrays form, angle[p * cap + i] is petal p of flower i,
+// so one call walks every flower with straight line float math the compiler can vectorize
+// results are bit for bit what Flower_update gives for the same flower
+// keyframe tables are not played here, a flower with one playing has to use Flower_update
+typedef struct {
+    int    count;
+    int    cap;
+    float *current;       // FLOWER_MAX_PETALS rows of cap
+    float *target;        // same layout
+    int   *delay_ms;      // same layout
+    float *speed;         // per flower from here down
+    float *step;          // scratch, degrees each flower moves this tick
+    int   *num_petals;
+    int   *seq_active;
+    int   *elapsed_ms;
+} FlowerBatch;
+
+// returns 0 if the allocation failed
+int  FlowerBatch_init(FlowerBatch *b, int cap);
+void FlowerBatch_free(FlowerBatch *b);
+
+// copy the motion state of one flower in or out of row i (i < cap), load grows count to i + 1
+void FlowerBatch_load(FlowerBatch *b, int i, const Flower *f);
+void FlowerBatch_store(const FlowerBatch *b, int i, Flower *f);
+
+// Flower_update for flowers 0..count-1 in one pass
+void FlowerBatch_update(FlowerBatch *b, int dt_ms);
+
 // build a STATUS line into out:
 //   STATUS name=<name> state=MOVING|IDLE petal_angles=...
 // newline is added at the end if there is space
 void Flower_buildStatus(const Flower *f, char *out, size_t out_size);
 
+// binary wire format, picked with proto=bin in HELLO and confirmed by the server with
+//   PROTO bin id=<id>
+// every frame starts with a 3 byte header: magic, type, total length
+//
+// status frame:
+//   [0] FLOWER_FRAME_MAGIC
+//   [1] FLOWER_FRAME_STATUS
+//   [2] total length = FLOWER_FRAME_HEADER + 5 + num_petals
+//   [3] flags: bit 0 = moving, bits 4..7 = num_petals
+//   [4..7] flower id, big endian
+//   [8..]  one byte per petal, angle in whole degrees clamped to 0..255
+//
+// delta frame, only the petals that changed:
+//   [0..7] same as the status frame but type FLOWER_FRAME_DELTA
+//   [8]    bit i set = petal i follows
+//   [9..]  one byte per set bit, lowest petal first
+#define FLOWER_FRAME_MAGIC   0xF5   // can never start a text line
+#define FLOWER_FRAME_HEADER  3
+#define FLOWER_FRAME_MAX     32     // no frame is ever longer than this
+#define FLOWER_FRAME_STATUS  0x01
+#define FLOWER_FRAME_DELTA   0x02
+#define FLOWER_FRAME_CMD     0x03
+
+typedef struct {
+    uint32_t id;
+    int      moving;
+    int      num_petals;
+    uint8_t  angles[FLOWER_MAX_PETALS];
+} FlowerStatusFrame;
+
+// command frame, server to flower, only to flowers that asked for proto=bin:
+//   [0] FLOWER_FRAME_MAGIC
+//   [1] FLOWER_FRAME_CMD
+//   [2] total length = FLOWER_FRAME_HEADER + 1
+//   [3] opcode (FLOWER_OP_*)
+// the flower still has to take text lines too, PROTO and PREDICT replies stay text
+
+// total length of the frame starting at in, or 0 if fewer than FLOWER_FRAME_HEADER bytes are available
+size_t Flower_frameLength(const unsigned char *in, size_t avail);
+
+// encode a status frame for f, returns the number of bytes written or 0 if out is too small
+size_t Flower_encodeStatus(const Flower *f, uint32_t id, unsigned char *out, size_t out_size);
+
+// encode a command frame, returns bytes written or 0 if out is too small or op is not a command
+// without arguments (those always go out as text lines)
+size_t Flower_encodeCommand(int op, unsigned char *out, size_t out_size);
+
+// opcode out of a complete command frame, FLOWER_OP_NONE if it is malformed
+int Flower_decodeCommand(const unsigned char *in, size_t len);
+
+// decode a complete status frame, returns 1 on success and 0 if it is malformed
+int Flower_decodeStatus(const unsigned char *in, size_t len, FlowerStatusFrame *out);
+
+// render a decoded frame as the same text Flower_buildStatus makes (without the newline)
+void Flower_formatStatusFrame(const FlowerStatusFrame *fr, const char *name, char *out, size_t out_size);
+
+// parse a text STATUS line into a frame (id is left at 0), returns 1 on success
+int Flower_parseStatusLine(const char *line, FlowerStatusFrame *out);
+
+// change driven reporting, instead of a full STATUS every tick the client only sends
+// what moved by at least threshold_deg (or a state change), plus a full status as heartbeat
+typedef struct {
+    int     threshold_deg;   // smallest angle change worth telling the server about
+    int     heartbeat_ms;    // full status at least this often even if nothing changed
+    int     since_full_ms;
+    int     has_sent;        // nothing sent yet means the first report is always full
+    int     moving;
+    uint8_t angles[FLOWER_MAX_PETALS];   // what the server currently believes
+} FlowerReporter;
+
+#define FLOWER_REPORT_NONE  0
+#define FLOWER_REPORT_FULL  1
+#define FLOWER_REPORT_DELTA 2
+
+void FlowerReporter_init(FlowerReporter *r, int threshold_deg, int heartbeat_ms);
+
+// call once per tick after Flower_update, returns what should be sent
+// for FLOWER_REPORT_DELTA *mask has a bit set for every petal to include
+// the reporter assumes whatever it asked for actually gets sent
+int FlowerReporter_step(FlowerReporter *r, const Flower *f, int dt_ms, unsigned *mask);
+
+// text delta line:  DELTA name=<name> state=MOVING|IDLE petals=<i>:<angle>,...
+void Flower_buildDelta(const Flower *f, unsigned mask, char *out, size_t out_size);
+
+// binary delta frame, returns bytes written or 0 if out is too small
+size_t Flower_encodeDelta(const Flower *f, uint32_t id, unsigned mask, unsigned char *out, size_t out_size);
+
+// apply a delta (frame or text line) on top of a snapshot that already has a full status in it
+// returns 1 on success, 0 if the delta is malformed or there is no snapshot to apply it to
+int Flower_applyDeltaFrame(const unsigned char *in, size_t len, FlowerStatusFrame *snap);
+int Flower_applyDeltaLine(const char *line, FlowerStatusFrame *snap);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,364 @@
+// flower_bench.c
+// microbenchmarks for the flower.c functions that run on every tick and every command
+//
+// every function is run for 1..8 petals with the flower in three states:
+//   IDLE    closed and at rest, nothing to do
+//   MOVING  OPEN just started, every petal is heading for the bloom angle
+//   SEQ     SEQ1 just started, some petals still wait out their delay
+// and reported as ns/op and allocations/op (malloc / calloc / realloc calls from flower.c,
+// counted by linking with --wrap, see the makefile), with -p also cycles, instructions and
+// branch misses per op from perf_event_open when the kernel lets us have them
+//
+// functions that move the flower forward would leave the state being measured after a while,
+// so the flower is put back every BENCH_RESTORE ops, that copy is a few percent of one op at most
+//
+// before any timing it checks that FlowerBatch_update moves flowers exactly like Flower_update
+// does, a fast batch path that gives different angles is not worth timing so a mismatch exits 1
+// -c runs only that check (make check)
+
+#include "flower.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define BENCH_DT_MS       10     // Flower_update step, a host with many flowers ticks about this fast
+#define BENCH_RESTORE     64     // ops between putting the flower back into its state
+#define BENCH_BATCH       1024   // flowers in the FlowerBatch_update case
+#define CHECK_FLOWERS     2000   // flowers in the batch vs Flower_update check
+#define CHECK_TICKS       500
+
+// every allocation flower.c makes goes through these (-Wl,--wrap=malloc and friends)
+static unsigned long allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    allocs++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+    allocs++;
+    return __real_realloc(p, size);
+}
+
+enum { STATE_IDLE, STATE_MOVING, STATE_SEQ, STATE_COUNT };
+static const char *state_names[STATE_COUNT] = { "IDLE", "MOVING", "SEQ" };
+
+// perf counters, one group read per measurement
+enum { PERF_CYCLES, PERF_INSTR, PERF_BRMISS, PERF_COUNT };
+static int perf_fd[PERF_COUNT] = { -1, -1, -1 };
+static int use_perf = 0;
+
+static int64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int perf_open_one(uint64_t config, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = (group == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// 1 if all three counters are there, most containers and VMs say no and that is fine
+static int perf_init(void) {
+    perf_fd[PERF_CYCLES] = perf_open_one(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (perf_fd[PERF_CYCLES] < 0) return 0;
+    perf_fd[PERF_INSTR]  = perf_open_one(PERF_COUNT_HW_INSTRUCTIONS, perf_fd[PERF_CYCLES]);
+    perf_fd[PERF_BRMISS] = perf_open_one(PERF_COUNT_HW_BRANCH_MISSES, perf_fd[PERF_CYCLES]);
+    if (perf_fd[PERF_INSTR] < 0 || perf_fd[PERF_BRMISS] < 0) {
+        for (int i = 0; i < PERF_COUNT; i++) {
+            if (perf_fd[i] >= 0) close(perf_fd[i]);
+            perf_fd[i] = -1;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+static void perf_start(void) {
+    if (!use_perf) return;
+    ioctl(perf_fd[PERF_CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf_fd[PERF_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void perf_stop(uint64_t out[PERF_COUNT]) {
+    memset(out, 0, PERF_COUNT * sizeof(uint64_t));
+    if (!use_perf) return;
+    ioctl(perf_fd[PERF_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    uint64_t buf[1 + PERF_COUNT];
+    if (read(perf_fd[PERF_CYCLES], buf, sizeof(buf)) == (ssize_t)sizeof(buf) && buf[0] == PERF_COUNT) {
+        memcpy(out, buf + 1, PERF_COUNT * sizeof(uint64_t));
+    }
+}
+
+static void make_state(Flower *f, int petals, int state) {
+    Flower_init(f, "bench", petals);
+    if (state == STATE_MOVING) {
+        Flower_applyOpcode(f, FLOWER_OP_OPEN);
+        Flower_update(f, 100);
+    } else if (state == STATE_SEQ) {
+        Flower_applyOpcode(f, FLOWER_OP_SEQ1);
+        Flower_update(f, 100);
+    }
+}
+
+// the functions under test, one op each
+static char status_buf[256];
+static const char *commands[] = { "OPEN", "CLOSE", "SEQ1", "SEQ2", "SET speed=30 gap=150" };
+#define NUM_COMMANDS ((int)(sizeof(commands) / sizeof(commands[0])))
+
+static void op_update(Flower *f, int i) {
+    (void)i;
+    Flower_update(f, BENCH_DT_MS);
+}
+
+static void op_build_status(Flower *f, int i) {
+    (void)i;
+    Flower_buildStatus(f, status_buf, sizeof(status_buf));
+}
+
+static void op_apply_command(Flower *f, int i) {
+    Flower_applyCommand(f, commands[i % NUM_COMMANDS]);
+}
+
+typedef struct {
+    const char *name;
+    void (*op)(Flower *f, int i);
+} BenchFn;
+
+static const BenchFn functions[] = {
+    { "Flower_update",       op_update },
+    { "Flower_buildStatus",  op_build_status },
+    { "Flower_applyCommand", op_apply_command },
+};
+
+typedef struct {
+    double ns;
+    double allocs;
+    double perf[PERF_COUNT];
+} BenchResult;
+
+// runs chunks of BENCH_RESTORE ops until min_ms went by
+static void bench_fn(const BenchFn *fn, const Flower *start, int min_ms, BenchResult *r) {
+    Flower f;
+    long ops = 0;
+    uint64_t perf[PERF_COUNT];
+    int64_t limit = (int64_t)min_ms * 1000000LL;
+
+    unsigned long allocs0 = allocs;
+    perf_start();
+    int64_t t0 = mono_ns();
+    int64_t elapsed;
+    do {
+        for (int chunk = 0; chunk < 64; chunk++) {   // the clock is only read every 64 chunks
+            f = *start;
+            for (int i = 0; i < BENCH_RESTORE; i++) fn->op(&f, i);
+            ops += BENCH_RESTORE;
+        }
+        elapsed = mono_ns() - t0;
+    } while (elapsed < limit);
+    perf_stop(perf);
+
+    r->ns = (double)elapsed / (double)ops;
+    r->allocs = (double)(allocs - allocs0) / (double)ops;
+    for (int k = 0; k < PERF_COUNT; k++) r->perf[k] = (double)perf[k] / (double)ops;
+}
+
+// FlowerBatch_update over BENCH_BATCH flowers in the same state, reported per flower so it
+// lines up with the Flower_update rows above it
+static void bench_batch(const Flower *start, int min_ms, BenchResult *r) {
+    FlowerBatch b;
+    uint64_t perf[PERF_COUNT];
+    long ops = 0;
+    int64_t limit = (int64_t)min_ms * 1000000LL;
+
+    unsigned long allocs0 = allocs;
+    if (!FlowerBatch_init(&b, BENCH_BATCH)) {
+        memset(r, 0, sizeof(*r));
+        return;
+    }
+    unsigned long init_allocs = allocs - allocs0;   // setup, not part of an op
+
+    perf_start();
+    int64_t t0 = mono_ns();
+    int64_t elapsed;
+    do {
+        for (int i = 0; i < BENCH_BATCH; i++) FlowerBatch_load(&b, i, start);
+        for (int i = 0; i < BENCH_RESTORE; i++) FlowerBatch_update(&b, BENCH_DT_MS);
+        ops += (long)BENCH_RESTORE * BENCH_BATCH;
+        elapsed = mono_ns() - t0;
+    } while (elapsed < limit);
+    perf_stop(perf);
+    FlowerBatch_free(&b);
+
+    r->ns = (double)elapsed / (double)ops;
+    r->allocs = (double)(allocs - allocs0 - init_allocs) / (double)ops;
+    for (int k = 0; k < PERF_COUNT; k++) r->perf[k] = (double)perf[k] / (double)ops;
+}
+
+// random commands for the check, KEYS is left out because FlowerBatch does not play tables
+static void random_command(char *buf, size_t size) {
+    switch (rand() % 8) {
+    case 0: snprintf(buf, size, "OPEN"); break;
+    case 1: snprintf(buf, size, "CLOSE"); break;
+    case 2: snprintf(buf, size, "SEQ1"); break;
+    case 3: snprintf(buf, size, "SEQ2"); break;
+    case 4: snprintf(buf, size, "SET speed=%d gap=%d", 1 + rand() % 200, rand() % 400); break;
+    case 5: snprintf(buf, size, "SET bloom=%d close=%d", rand() % 181, rand() % 181); break;
+    case 6: snprintf(buf, size, "ANGLE i=%d deg=%d", rand() % FLOWER_MAX_PETALS, rand() % 181); break;
+    default: snprintf(buf, size, "ANGLE i=all deg=%d.%d", rand() % 181, rand() % 10); break;
+    }
+}
+
+// steps CHECK_FLOWERS random flowers through Flower_update and FlowerBatch_update side by side
+// with random dt and now and then a random command, the angles have to match bit for bit
+// after every tick, returns the number of flowers that did not
+static long check_batch(void) {
+    static Flower scalar[CHECK_FLOWERS];
+    static Flower batched[CHECK_FLOWERS];   // everything FlowerBatch does not keep
+    FlowerBatch b;
+    if (!FlowerBatch_init(&b, CHECK_FLOWERS)) {
+        printf("check: FlowerBatch_init failed\n");
+        return 1;
+    }
+
+    srand(12345);   // same flowers every run so a mismatch can be chased down
+    for (int i = 0; i < CHECK_FLOWERS; i++) {
+        Flower_init(&scalar[i], "check", 1 + rand() % FLOWER_MAX_PETALS);
+        batched[i] = scalar[i];
+        FlowerBatch_load(&b, i, &batched[i]);
+    }
+
+    long mismatches = 0;
+    for (int tick = 0; tick < CHECK_TICKS; tick++) {
+        for (int i = 0; i < CHECK_FLOWERS; i++) {
+            if (rand() % 16 != 0) continue;
+            char cmd[64];
+            random_command(cmd, sizeof(cmd));
+            Flower_applyCommand(&scalar[i], cmd);
+            FlowerBatch_store(&b, i, &batched[i]);
+            Flower_applyCommand(&batched[i], cmd);
+            FlowerBatch_load(&b, i, &batched[i]);
+        }
+
+        int dt = (rand() % 8 == 0) ? 0 : 1 + rand() % 50;
+        for (int i = 0; i < CHECK_FLOWERS; i++) Flower_update(&scalar[i], dt);
+        FlowerBatch_update(&b, dt);
+
+        for (int i = 0; i < CHECK_FLOWERS; i++) {
+            float got[FLOWER_MAX_PETALS], want[FLOWER_MAX_PETALS];
+            int n = scalar[i].num_petals;
+            for (int p = 0; p < n; p++) {
+                got[p]  = b.current[p * b.cap + i];
+                want[p] = scalar[i].petals[p].current_angle;
+            }
+            if (memcmp(got, want, n * sizeof(float)) == 0) continue;
+            if (mismatches < 10) {
+                printf("check: flower %d differs after tick %d (dt %d):", i, tick, dt);
+                for (int p = 0; p < n; p++) printf(" %.9g/%.9g", got[p], want[p]);
+                printf("  (batch/scalar)\n");
+            }
+            mismatches++;
+            // line it back up so one difference is not reported on every tick after
+            FlowerBatch_load(&b, i, &scalar[i]);
+            batched[i] = scalar[i];
+        }
+    }
+    FlowerBatch_free(&b);
+
+    if (mismatches == 0) {
+        printf("check: FlowerBatch_update matches Flower_update (%d flowers, %d ticks)\n",
+               CHECK_FLOWERS, CHECK_TICKS);
+    } else {
+        printf("check: %ld mismatches between FlowerBatch_update and Flower_update\n", mismatches);
+    }
+    return mismatches;
+}
+
+static void print_row(const char *name, int petals, int state, const BenchResult *r) {
+    printf("%-22s %6d  %-6s %9.1f %10.3f", name, petals, state_names[state], r->ns, r->allocs);
+    if (use_perf) {
+        printf(" %10.1f %10.1f %9.3f", r->perf[PERF_CYCLES], r->perf[PERF_INSTR], r->perf[PERF_BRMISS]);
+    }
+    printf("\n");
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-c] [-t ms] [-p] [-f name]\n"
+            "  -c       only check FlowerBatch_update against Flower_update, exit 1 on a mismatch\n"
+            "  -t ms    time spent on each row (default 50)\n"
+            "  -p       also read cycles / instructions / branch misses with perf_event_open\n"
+            "  -f name  only the functions whose name contains this\n",
+            prog);
+    exit(0);
+}
+
+int main(int argc, char **argv) {
+    int min_ms = 50;
+    const char *only = NULL;
+    int check_only = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "ct:pf:")) != -1) {
+        switch (opt) {
+        case 'c': check_only = 1; break;
+        case 't': min_ms = atoi(optarg); break;
+        case 'p': use_perf = 1; break;
+        case 'f': only = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (check_batch() != 0) return 1;
+    if (check_only) return 0;
+    if (min_ms < 1) min_ms = 1;
+    if (use_perf && !perf_init()) {
+        printf("perf counters are not available here, timing only\n");
+        use_perf = 0;
+    }
+
+    printf("%-22s %6s  %-6s %9s %10s", "function", "petals", "state", "ns/op", "allocs/op");
+    if (use_perf) printf(" %10s %10s %9s", "cycles/op", "instr/op", "brmiss/op");
+    printf("\n");
+
+    int nfn = (int)(sizeof(functions) / sizeof(functions[0]));
+    for (int k = 0; k <= nfn; k++) {
+        const char *name = (k < nfn) ? functions[k].name : "FlowerBatch_update";
+        if (only != NULL && strstr(name, only) == NULL) continue;
+
+        for (int state = 0; state < STATE_COUNT; state++) {
+            for (int petals = 1; petals <= FLOWER_MAX_PETALS; petals++) {
+                Flower start;
+                BenchResult r;
+                make_state(&start, petals, state);
+                if (k < nfn) bench_fn(&functions[k], &start, min_ms, &r);
+                else bench_batch(&start, min_ms, &r);
+                print_row(name, petals, state, &r);
+            }
+        }
+    }
+    return 0;
+}
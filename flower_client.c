@@ -2,227 +2,615 @@
 // one flower node that will connect to the garden server
 // basically this is one machine that listens for commands and moves its petals
 
+// the motion thread owns the flower outright, the receiver never touches it
+// commands get to it through a lock free queue, anybody else who wants to look at the
+// petals reads a seqlock snapshot, and console output goes through the async logger
+// so nobody waits on anybody for longer than a memcpy
+
 #include "csapp.h"
 #include "flower.h"
+#include "flower_host.h"
+#include "ticker.h"
+#include "cmdqueue.h"
+#include "asynclog.h"
+#include "clocksync.h"
+#include "ringbuf.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 
-static int running = 1;   // overall "should this client keep going" value
-static int terminating = 0;   // sets when terminate gets received
+static int running = 1;   // overall "should this client keep going" value, motion thread only
+static int terminating = 0;   // sets when terminate gets received, motion thread only
 static int connfd = -1;   // socket to the garden server
 
-// my one global flower state for this client
+static int      want_bin = 0;    // -b, ask the server for binary status frames
+static int      proto_bin = 0;   // server said yes, motion thread only
+static uint32_t flower_id = 0;   // id the server gave us along with PROTO bin
+
+// -d turns on change driven reporting, only petals that moved at least -t degrees get sent,
+// plus a full status every -H ms so the server knows we are still alive
+static int delta_mode = 0;
+static int delta_threshold_deg = 1;
+static int heartbeat_ms = 2000;
+
+// -p lets the server run the same flower model we do, then we only send a status when our real
+// pose is at least predict_error_deg away from what the server thinks (or as a heartbeat)
+static int want_predict = 0;
+static int predict_error_deg = 2;
+
+// motion runs on a 100ms grid of absolute deadlines, after a stall the missed time is
+// replayed in 100ms steps but never more than MOTION_MAX_CATCHUP_MS of it
+#define MOTION_TICK_MS         100
+#define MOTION_MAX_CATCHUP_MS  2000
+
+// the servers clock is sampled a few times right after HELLO and then every so often
+// so commands with a start time (@t=) land at the same moment on every flower
+#define CLOCK_SYNC_BURST      4       // samples right after HELLO, one per tick
+#define CLOCK_RESYNC_MS       10000   // then one of these apart, well inside the servers -e
+#define HELD_MAX              16      // timed commands waiting for their start time
+
+// my one global flower state for this client, only the motion thread touches it once it runs
 static Flower g_flower;
-// mutex so the motion thread and receiver thread dont mess up my business
-static pthread_mutex_t flower_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-// basic helper so i dont have stray newlines
-static void trim_newline(char *s) {
-    if (s == NULL) return;
-    size_t len = strlen(s);
-    while (len > 0 && (s[len - 1] == '\n' || s[len - 1] == '\r')) {
-        s[len - 1] = '\0';
-        len--;
+// what the server predicts for us, same commands and same model, re-anchored on every report
+// only used once the server answered PREDICT ok, motion thread only
+static int     predict_on = 0;
+static Flower  model;
+static int64_t model_anchor_ms = 0;
+static unsigned long reports_sent = 0;   // motion thread only
+
+// last pose the motion thread published, any thread can read it without stopping motion
+static atomic_uint snap_seq;   // odd while the motion thread is copying in
+static Flower      snap;
+
+// receiver -> motion thread, an empty non command in here means the server went away
+static CmdQueue cmdq;
+// offset to the server clock, the receiver gets the TIME replies so it owns this and turns
+// every @t= into our own time before the command is queued
+static ClockSync clock_sync;
+// timed commands the motion thread took off the queue early, applied at their due_ms
+static CmdItem held[HELD_MAX];
+static int     held_count = 0;   // motion thread only
+// the motion thread sleeps on this until its next tick or until something got queued
+// the mutex only exists for the condition variable (uses CLOCK_MONOTONIC)
+static pthread_mutex_t motion_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  motion_cond;
+
+static void wake_motion(void) {
+    pthread_mutex_lock(&motion_mutex);
+    pthread_cond_signal(&motion_cond);
+    pthread_mutex_unlock(&motion_mutex);
+}
+
+static int64_t mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// motion thread only, single writer so a plain increment makes the count odd
+static void publish_snapshot(void) {
+    atomic_fetch_add_explicit(&snap_seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    snap = g_flower;
+    atomic_fetch_add_explicit(&snap_seq, 1, memory_order_release);
+}
+
+// seqlock reader side, just copies again if the motion thread was in the middle of publishing
+static void read_snapshot(Flower *out) {
+    unsigned s1, s2;
+    do {
+        s1 = atomic_load_explicit(&snap_seq, memory_order_acquire);
+        if (s1 & 1) continue;
+        *out = snap;
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(&snap_seq, memory_order_relaxed);
+    } while ((s1 & 1) || s1 != s2);
+}
+
+// " [ 12] [ 40] ..." for every petal, what all the console lines show
+static void format_angles(const Flower *f, char *out, size_t out_size) {
+    size_t used = 0;
+    out[0] = '\0';
+    for (int i = 0; i < f->num_petals && i < FLOWER_MAX_PETALS; i++) {
+        int n = snprintf(out + used, out_size - used, " [%3d]",
+                         (int)(f->petals[i].current_angle + 0.5f));
+        if (n < 0 || (size_t)n >= out_size - used) break;
+        used += (size_t)n;
+    }
+}
+
+// the server applies every command to its copy of us the moment it queues it,
+// we mirror that here when it arrives (a network hop later, well inside the error budget)
+static void model_command(const FlowerCmd *c) {
+    if (!predict_on) return;
+    int64_t now = mono_ms();
+    Flower_advance(&model, (int)(now - model_anchor_ms));
+    model_anchor_ms = now;
+    Flower_applyCmd(&model, c);
+}
+
+// 1 if the servers prediction is off from where we really are by the error budget or more
+// compared in whole degrees because that is all a status carries
+static int model_is_off(void) {
+    Flower m = model;
+    Flower_advance(&m, (int)(mono_ms() - model_anchor_ms));
+    for (int i = 0; i < g_flower.num_petals; i++) {
+        int real = (int)(g_flower.petals[i].current_angle + 0.5f);
+        int said = (int)(m.petals[i].current_angle + 0.5f);
+        if (real - said >= predict_error_deg || said - real >= predict_error_deg) return 1;
+    }
+    return 0;
+}
+
+// we just sent a full status, the server moves its copy to exactly those numbers so we do too
+static void model_resync(void) {
+    int64_t now = mono_ms();
+    Flower_advance(&model, (int)(now - model_anchor_ms));
+    model_anchor_ms = now;
+    for (int i = 0; i < g_flower.num_petals; i++) {
+        model.petals[i].current_angle = (float)(int)(g_flower.petals[i].current_angle + 0.5f);
     }
 }
 
 // small wrapper around write that knows about this clients socket and name
-static void sendLine(const char *line) {
+static void sendBytes(const void *buf, size_t len) {
     if (connfd < 0) return;
-    ssize_t n = write(connfd, line, strlen(line));
+    ssize_t n = write(connfd, buf, len);
     if (n < 0) {
         // this is per flower so just log with name if we have one
-        printf("[%-8s] Warning: write() failed\n",
-               (g_flower.name[0] ? g_flower.name : "client"));
+        AsyncLog_log(LOG_LEVEL_WARN, "[%-8s] Warning: write() failed\n",
+                     (g_flower.name[0] ? g_flower.name : "client"));
     }
 }
 
-// quick snapshot print of all petal angles with a label
+static void sendLine(const char *line) {
+    sendBytes(line, strlen(line));
+}
+
+// quick snapshot print of all petal angles with a label, safe from any thread
 static void print_flower_snapshot(const char *label) {
-    pthread_mutex_lock(&flower_mutex);
+    Flower f;
+    read_snapshot(&f);
 
-    int num = g_flower.num_petals;
-    if (num > FLOWER_MAX_PETALS) num = FLOWER_MAX_PETALS;
+    char angles[8 * FLOWER_MAX_PETALS + 1];
+    format_angles(&f, angles, sizeof(angles));
+    AsyncLog_printf("[%-8s] %s:%s\n", f.name[0] ? f.name : "flower", label, angles);
+}
 
-    char name_copy[32];
-    strncpy(name_copy, g_flower.name, sizeof(name_copy) - 1);
-    name_copy[sizeof(name_copy) - 1] = '\0';
+// handle one command from the server, runs on the motion thread
+static void handle_command(const CmdItem *it) {
+    const char *name_tag = g_flower.name[0] ? g_flower.name : "flower";
+    const char *line = it->line;
+    int op = it->cmd.op;
 
-    int angles[FLOWER_MAX_PETALS];
-    for (int i = 0; i < num; i++) {
-        angles[i] = (int)(g_flower.petals[i].current_angle + 0.5f);
+    if (op == FLOWER_OP_TERMINATE) {
+        // server is telling this flower to gracefully shut down
+        AsyncLog_printf("[%-8s] cmd: TERMINATE (closing before shutdown)\n", name_tag);
+        Flower_applyCmd(&g_flower, &it->cmd);   // closes the petals
+        model_command(&it->cmd);
+        terminating = 1;
+        // receiver thread stopped after this; motion thread will finish close
+        return;
     }
 
-    pthread_mutex_unlock(&flower_mutex);
+    if (op != FLOWER_OP_NONE) {
+        // normal commands just go straight into the flower logic
+        Flower_applyCmd(&g_flower, &it->cmd);
+        model_command(&it->cmd);
+        AsyncLog_printf("[%-8s] cmd: %s\n", name_tag, Flower_opName(op));
+        return;
+    }
 
-    printf("[%-8s] %s:", name_copy[0] ? name_copy : "flower", label);
-    for (int i = 0; i < num; i++) {
-        printf(" [%3d]", angles[i]);
+    // receiver hit eof, unless we are closing for a terminate there is nothing left to do
+    if (it->len == 0) {
+        if (!terminating) {
+            running = 0;
+        }
+        return;
     }
-    printf("\n");
-}
 
-// handle a single command line from the server
-static void handle_command_line(const char *line) {
-    // skip leading spaces just inncase
-    while (*line == ' ' || *line == '\t') {
-        line++;
+    // server accepted proto=bin from our HELLO, status goes out as frames from now on
+    if (strncmp(line, "PROTO bin id=", 13) == 0) {
+        flower_id = (uint32_t)strtoul(line + 13, NULL, 10);
+        proto_bin = 1;
+        AsyncLog_printf("[%-8s] using binary status frames (id=%u)\n", name_tag, flower_id);
+        return;
     }
-    if (*line == '\0') {
-        return; // empty
+
+    // server accepted predict=1, start the copy of its model from where we are right now
+    if (strcmp(line, "PREDICT ok") == 0) {
+        model = g_flower;
+        model_anchor_ms = mono_ms();
+        predict_on = 1;
+        AsyncLog_printf("[%-8s] server predicts our pose, sending corrections only\n", name_tag);
+        return;
     }
 
-    const char *name_tag = g_flower.name[0] ? g_flower.name : "flower";
+    // unknown (or malformed) commands are just ignored so the client does not explode!
+    AsyncLog_printf("[%-8s] cmd: %s (ignored)\n", name_tag, line);
+}
 
-    if (strcmp(line, "TERMINATE") == 0) {
-        // server is telling this flower to gracefully shut down
-        printf("[%-8s] cmd: TERMINATE (closing before shutdown)\n", name_tag);
-        pthread_mutex_lock(&flower_mutex);
-        Flower_applyCommand(&g_flower, "CLOSE");
-        terminating = 1;
-        pthread_mutex_unlock(&flower_mutex);
-        // receiver thread will stop after this; motion thread will finish close
-        return;
+// receiver side, a free queue slot to parse the next command into
+// the queue only fills up if the motion thread is stuck, so just give it a moment
+static CmdItem *queue_slot(void) {
+    CmdItem *it;
+    while ((it = CmdQueue_reserve(&cmdq)) == NULL) {
+        wake_motion();
+        usleep(1000);
     }
+    return it;
+}
 
-    // normal commands just go straight into the flower logic
-    pthread_mutex_lock(&flower_mutex);
-    Flower_applyCommand(&g_flower, line);
-    pthread_mutex_unlock(&flower_mutex);
+static void queue_commit(void) {
+    CmdQueue_commit(&cmdq);
+    wake_motion();
+}
 
-    printf("[%-8s] cmd: %s\n", name_tag, line);
+// tells the motion thread the server is gone, an item that is neither command nor line
+static void queue_disconnect(void) {
+    CmdItem *it = queue_slot();
+    it->cmd.op = FLOWER_OP_NONE;
+    it->due_ms = 0;
+    it->len = 0;
+    queue_commit();
 }
 
-// thread that receives commands from the server and feeds them into handle_command_line function
-static void* receiver_thread(void *arg) {
-    (void)arg;
-    char buf[MAXLINE];
+// puts a timed command aside in held[] until its start time
+// when held[] is full the command that would start last is dropped, starting one early would
+// put the flower somewhere the server does not think it is
+static void hold_command(const CmdItem *it, int64_t wait) {
+    if (held_count == HELD_MAX) {
+        int last = 0;
+        for (int i = 1; i < held_count; i++) {
+            if (held[i].due_ms > held[last].due_ms) last = i;
+        }
+        int keep_new = it->due_ms < held[last].due_ms;
+        AsyncLog_log(LOG_LEVEL_WARN, "[%-8s] too many timed commands waiting, dropping %s\n",
+                     g_flower.name, Flower_opName(keep_new ? held[last].cmd.op : it->cmd.op));
+        if (!keep_new) return;
+        held[last] = held[--held_count];
+    }
+    held[held_count++] = *it;
+    AsyncLog_printf("[%-8s] cmd: %s in %lld ms\n", g_flower.name,
+                    Flower_opName(it->cmd.op), (long long)wait);
+}
 
-    while (1) {
-        ssize_t n = read(connfd, buf, MAXLINE - 1);
-        if (n <= 0) {
-            const char *name_tag = g_flower.name[0] ? g_flower.name : "flower";
-            printf("[%-8s] server closed connection or read error.\n", name_tag);
-            if (!terminating) {
-                running = 0;
+// motion thread side, applies everything the receiver queued so far
+// a command with a start time still to come is put aside in held[] instead
+static void drain_commands(void) {
+    const CmdItem *it;
+    while ((it = CmdQueue_front(&cmdq)) != NULL) {
+        int64_t wait = it->due_ms - mono_ms();
+        if (it->due_ms > 0 && wait > 0) {
+            hold_command(it, wait);
+        } else {
+            // no start time, or it already passed while the command was on its way
+            handle_command(it);
+        }
+        CmdQueue_pop(&cmdq);
+    }
+}
+
+// earliest start time in held[], 0 if nothing is held
+static int64_t next_held_ms(void) {
+    int64_t at = 0;
+    for (int i = 0; i < held_count; i++) {
+        if (at == 0 || held[i].due_ms < at) at = held[i].due_ms;
+    }
+    return at;
+}
+
+// applies the held commands whose start time came, oldest first
+// the petals are first moved to exactly now, the tick that is under way would otherwise
+// count the time before the start too and every flower would be off by a different bit of it
+// returns the ms of motion that were stepped here so the reporter can be told about them
+static int run_held(Ticker *ticker, int idle) {
+    int stepped = 0;
+    int64_t at;
+    while ((at = next_held_ms()) != 0 && at <= mono_ms()) {
+        if (!idle) {
+            // idle means nothing is moving and the ticker restarts afterwards anyway
+            int dt = Ticker_catchUp(ticker);
+            for (int left = dt; left > 0; left -= MOTION_TICK_MS) {
+                Flower_update(&g_flower, left < MOTION_TICK_MS ? left : MOTION_TICK_MS);
             }
+            stepped += dt;
+        }
+        for (int i = 0; i < held_count; i++) {
+            if (held[i].due_ms != at) continue;
+            handle_command(&held[i]);
+            held[i] = held[--held_count];
             break;
         }
+    }
+    return stepped;
+}
+
+// motion thread side, TIME requests go out on the same socket as the statuses
+// returns when the next one is due
+static int64_t clock_ping(int64_t now) {
+    static int sent = 0;
+    char req[48];
+    size_t len = ClockSync_request(req, sizeof(req), now);
+    if (len > 0) sendBytes(req, len);
+    sent++;
+    return now + (sent < CLOCK_SYNC_BURST ? MOTION_TICK_MS : CLOCK_RESYNC_MS);
+}
 
-        buf[n] = '\0';
+// moves the wait deadline up to at_ms if that comes first
+static void wake_by(struct timespec *deadline, const struct timespec **until, int64_t at_ms) {
+    if (*until != NULL && (int64_t)deadline->tv_sec * 1000 + deadline->tv_nsec / 1000000 <= at_ms) {
+        return;
+    }
+    deadline->tv_sec  = (time_t)(at_ms / 1000);
+    deadline->tv_nsec = (long)(at_ms % 1000) * 1000000L;
+    *until = deadline;
+}
 
-        // server can send more than one command in one read so split on newlines
-        char *cursor = buf;
-        while (running && cursor && *cursor) {
-            // find end of line
-            char *eol = strpbrk(cursor, "\r\n");
-            if (eol != NULL) {
-                *eol = '\0'; // terminate
+// queues every complete command sitting in the ring, each one is parsed right where it sits
+// straight into its queue slot, a binary command frame is nothing but the opcode
+// returns 1 once TERMINATE came in since nothing after that matters
+static int receive_pending(RingBuf *in) {
+    while (1) {
+        const unsigned char *p = (const unsigned char *)RingBuf_peek(in, 1);
+        if (p == NULL) return 0;
+
+        int op;
+        if (want_bin && p[0] == FLOWER_FRAME_MAGIC) {
+            p = (const unsigned char *)RingBuf_peek(in, FLOWER_FRAME_HEADER);
+            if (p == NULL) return 0;   // rest of the header is still on its way
+            size_t flen = Flower_frameLength(p, FLOWER_FRAME_HEADER);
+            if (flen < FLOWER_FRAME_HEADER || flen > FLOWER_FRAME_MAX) {
+                // lost the framing, skip a byte and hope the next one is a fresh start
+                RingBuf_consume(in, 1);
+                continue;
             }
+            p = (const unsigned char *)RingBuf_peek(in, flen);
+            if (p == NULL) return 0;
+            op = Flower_decodeCommand(p, flen);
+            RingBuf_consume(in, flen);
+            if (op == FLOWER_OP_NONE) continue;
+
+            CmdItem *it = queue_slot();
+            it->cmd.op = op;
+            it->due_ms = 0;
+            it->len = 0;
+            queue_commit();
+        } else {
+            const char *line;
+            size_t len;
+            int rc = RingBuf_nextLine(in, &line, &len);
+            if (rc == 0) return 0;
+            if (rc < 0) continue;   // nobody sends lines that long
+
+            // skip leading spaces just inncase
+            while (len > 0 && (*line == ' ' || *line == '\t')) {
+                line++;
+                len--;
+            }
+            if (len == 0) continue;
 
-            // working copy for trimming
-            char line_copy[128];
-            strncpy(line_copy, cursor, sizeof(line_copy) - 1);
-            line_copy[sizeof(line_copy) - 1] = '\0';
-            trim_newline(line_copy);
-
-            if (line_copy[0] != '\0') {
-                handle_command_line(line_copy);
-                if (terminating) {
-                    // got terminate so motion thread will finish things before donezo
-                    break;
+            // clock sync replies never go to the motion thread, the time they came in is the point
+            if (ClockSync_reply(&clock_sync, line, len, mono_ms())) {
+                if (clock_sync.count == 1) {
+                    AsyncLog_printf("[%-8s] clock synced with the server (round trip %lld ms)\n",
+                                    g_flower.name, (long long)ClockSync_rtt(&clock_sync));
                 }
+                continue;
             }
 
-            if (eol == NULL) {
-                break; // no more lines in buff
+            // a start time on the servers clock becomes one on ours right here
+            int64_t at;
+            size_t cmd_len = len;
+            int timed = Flower_splitStartTime(line, &cmd_len, &at);
+
+            CmdItem *it = queue_slot();
+            op = Flower_parseCommand(line, cmd_len, &it->cmd);
+            it->due_ms = (timed && ClockSync_synced(&clock_sync)) ? ClockSync_toLocal(&clock_sync, at) : 0;
+            it->len = 0;
+            if (op == FLOWER_OP_NONE) {
+                // not a flower command, the motion thread needs the text
+                if (len > CMDQ_LINE_MAX - 1) len = CMDQ_LINE_MAX - 1;
+                memcpy(it->line, line, len);
+                it->line[len] = '\0';
+                it->len = (int)len;
             }
+            queue_commit();
+        }
 
-            // move cursor past the NL
-            cursor = eol + 1;
-            while (*cursor == '\r' || *cursor == '\n') {
-                cursor++;
-            }
+        if (op == FLOWER_OP_TERMINATE) {
+            // got terminate so motion thread will finish things before donezo
+            return 1;
         }
+    }
+}
 
-        if (terminating) {
+// thread that receives commands from the server and queues them for the motion thread
+static void* receiver_thread(void *arg) {
+    (void)arg;
+    const char *name_tag = g_flower.name[0] ? g_flower.name : "flower";   // name never changes
+    RingBuf in;
+    if (!RingBuf_init(&in, 4096, FLOWER_CMD_MAX)) {
+        AsyncLog_printf("[%-8s] out of memory for the receive buffer\n", name_tag);
+        queue_disconnect();
+        return NULL;
+    }
+
+    while (1) {
+        ssize_t n = RingBuf_readFrom(&in, connfd);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            AsyncLog_printf("[%-8s] server closed connection or read error.\n", name_tag);
+            print_flower_snapshot("last pose");
+            queue_disconnect();
             break;
         }
+        if (receive_pending(&in)) break;
     }
 
+    RingBuf_free(&in);
     return NULL;
 }
 
+// sleeps until deadline (NULL = no deadline) or until the receiver queued something
+// returns 1 if the deadline was reached, 0 if there is a command to apply
+static int wait_tick_or_command(const struct timespec *deadline) {
+    int due = 0;
+
+    pthread_mutex_lock(&motion_mutex);
+    while (CmdQueue_empty(&cmdq)) {
+        int rc = (deadline == NULL)
+               ? pthread_cond_wait(&motion_cond, &motion_mutex)
+               : pthread_cond_timedwait(&motion_cond, &motion_mutex, deadline);
+        if (rc == ETIMEDOUT) {
+            due = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&motion_mutex);
+
+    return due;
+}
+
+// -d / -p only: if no petal will ever move again without a new command there is nothing to
+// animate and nothing to report until the heartbeat, so the motion thread stops ticking until
+// a command comes in or the heartbeat is one tick away
+static int can_idle(const FlowerReporter *reporter) {
+    if (terminating || Flower_nextEventTime(&g_flower) >= 0) return 0;
+    return reporter->heartbeat_ms <= 0
+        || reporter->heartbeat_ms - reporter->since_full_ms - MOTION_TICK_MS > 0;
+}
+
 // this thread actually animates the petals over time and sends the status updates
 // this part was cool
 static void* motion_thread(void *arg) {
     (void)arg;
 
-    const int dt_ms = 100;   // 100ms per update
+    Ticker ticker;
+    Ticker_init(&ticker, MOTION_TICK_MS, MOTION_MAX_CATCHUP_MS);
     char status[256];
+    size_t status_len = 0;
+    FlowerReporter reporter;
+    FlowerReporter_init(&reporter, delta_threshold_deg, heartbeat_ms);
     int counter = 0;
     int was_moving = 0;
     int announced_closing = 0;
+    int idle = 0;      // not ticking, see can_idle
+    int idle_ms = 0;   // time the reporter did not see go by yet (idle, or stepped by run_held)
+    int64_t next_sync_ms = mono_ms();
 
     while (running) {
-        usleep(dt_ms * 1000);
+        struct timespec deadline;
+        const struct timespec *until = &deadline;
+        int64_t idle_start = 0;
+        if (idle) {
+            idle_start = mono_ms();
+            if (reporter.heartbeat_ms <= 0) {
+                until = NULL;
+            } else {
+                int64_t at = idle_start + reporter.heartbeat_ms - reporter.since_full_ms
+                           - MOTION_TICK_MS;
+                deadline.tv_sec  = (time_t)(at / 1000);
+                deadline.tv_nsec = (long)(at % 1000) * 1000000L;
+            }
+        } else {
+            Ticker_deadline(&ticker, &deadline);
+        }
+        wake_by(&deadline, &until, next_sync_ms);
+        if (held_count > 0) wake_by(&deadline, &until, next_held_ms());
 
-        pthread_mutex_lock(&flower_mutex);
+        int due = wait_tick_or_command(until);
 
-        // step physicsish side forward a bit
-        Flower_update(&g_flower, dt_ms);
-        // build a status line to send to the server
-        Flower_buildStatus(&g_flower, status, sizeof(status));
+        // commands go in the moment they show up, they never wait for the tick
+        drain_commands();
+        int stepped = run_held(&ticker, idle);
+        if (!running) break;
 
-        int num = g_flower.num_petals;
-        if (num > FLOWER_MAX_PETALS) num = FLOWER_MAX_PETALS;
+        if (mono_ms() >= next_sync_ms) next_sync_ms = clock_ping(mono_ms());
 
-        // determine if any petal is still moving
-        int moving = 0;
-        for (int i = 0; i < num; i++) {
-            float diff = g_flower.petals[i].target_angle
-                       - g_flower.petals[i].current_angle;
-            if (diff > 0.5f || diff < -0.5f) {
-                moving = 1;
-                break;
-            }
+        if (idle) {
+            // a command or the heartbeat woke us, go back to ticking from now on
+            idle_ms = (int)(mono_ms() - idle_start);
+            Ticker_reset(&ticker);
+            idle = 0;
+            continue;
         }
+        idle_ms += stepped;
+        // the deadline may have been a held command or a clock ping and not the tick
+        if (!due || !Ticker_due(&ticker)) continue;
 
-        char name_copy[32];
-        strncpy(name_copy, g_flower.name, sizeof(name_copy) - 1);
-        name_copy[sizeof(name_copy) - 1] = '\0';
+        // however long it really was since the last tick, not just the 100ms we hoped for
+        // (the deadline already passed so this does not sleep)
+        int dt_ms = Ticker_wait(&ticker);
 
-        int angles[FLOWER_MAX_PETALS];
-        for (int i = 0; i < num; i++) {
-            angles[i] = (int)(g_flower.petals[i].current_angle + 0.5f);
+        // step physicsish side forward a bit, in tick sized pieces if we fell behind
+        for (int left = dt_ms; left > 0; left -= MOTION_TICK_MS) {
+            Flower_update(&g_flower, left < MOTION_TICK_MS ? left : MOTION_TICK_MS);
+        }
+        // build a status line (or frame) to send to the server
+        // in delta mode the reporter decides if it is a full one, just the changes, or nothing
+        // in predict mode it only handles first report / start / stop / heartbeat, anything
+        // else goes out only as a correction when the servers prediction drifted too far
+        int quiet = delta_mode || predict_on;
+        unsigned mask = 0;
+        int report = quiet ? FlowerReporter_step(&reporter, &g_flower, dt_ms + idle_ms, &mask)
+                           : FLOWER_REPORT_FULL;
+        idle_ms = 0;
+        if (predict_on) {
+            if (report != FLOWER_REPORT_FULL) {
+                report = model_is_off() ? FLOWER_REPORT_FULL : FLOWER_REPORT_NONE;
+            }
+            if (report == FLOWER_REPORT_FULL) model_resync();
+        }
+        status_len = 0;
+        if (report == FLOWER_REPORT_FULL) {
+            if (proto_bin) {
+                status_len = Flower_encodeStatus(&g_flower, flower_id,
+                                                 (unsigned char *)status, sizeof(status));
+            } else {
+                Flower_buildStatus(&g_flower, status, sizeof(status));
+                status_len = strlen(status);
+            }
+        } else if (report == FLOWER_REPORT_DELTA) {
+            if (proto_bin) {
+                status_len = Flower_encodeDelta(&g_flower, flower_id, mask,
+                                                (unsigned char *)status, sizeof(status));
+            } else {
+                Flower_buildDelta(&g_flower, mask, status, sizeof(status));
+                status_len = strlen(status);
+            }
         }
 
-        int local_terminating = terminating;
+        // send satus to server (every tick unless delta / predict mode had nothing to say)
+        if (status_len > 0) {
+            sendBytes(status, status_len);
+            reports_sent++;
+        }
 
-        pthread_mutex_unlock(&flower_mutex);
+        publish_snapshot();
 
-        // always send satus to server
-        sendLine(status);
+        // determine if any petal is still moving
+        int moving = Flower_isMoving(&g_flower);
 
-        const char *name_tag = name_copy[0] ? name_copy : "flower";
+        const char *name_tag = g_flower.name[0] ? g_flower.name : "flower";
+        char angles[8 * FLOWER_MAX_PETALS + 1];
+        format_angles(&g_flower, angles, sizeof(angles));
 
         // after terminate print a one time "Im closing!!" thing and be done
-        if (local_terminating && !announced_closing) {
-            printf("\n[%-8s] closing before shutdown...\n", name_tag);
+        if (terminating && !announced_closing) {
+            AsyncLog_printf("\n[%-8s] closing before shutdown...\n", name_tag);
             announced_closing = 1;
         }
 
         // once terminate has been requested and everybod si closed, be done
-        if (local_terminating && !moving) {
-            printf("\n[%-8s] final (closed):", name_tag);
-            for (int i = 0; i < num; i++) {
-                printf(" [%3d]", angles[i]);
-            }
-            printf("\n");
+        if (terminating && !moving) {
+            AsyncLog_printf("\n[%-8s] final (closed):%s\n", name_tag, angles);
             running = 0;
             break;
         }
@@ -233,48 +621,166 @@ static void* motion_thread(void *arg) {
 
             if (!was_moving) {
                 // movement just started
-                printf("\n[%-8s] moving:", name_tag);
-                for (int i = 0; i < num; i++) {
-                    printf(" [%3d]", angles[i]);
-                }
-                printf("\n");
+                AsyncLog_printf("\n[%-8s] moving:%s\n", name_tag, angles);
             } else if (counter % 5 == 0) { // every half second print
-                printf("[%-8s] moving:", name_tag);
-                for (int i = 0; i < num; i++) {
-                    printf(" [%3d]", angles[i]);
-                }
-                printf("\n");
+                AsyncLog_printf("[%-8s] moving:%s\n", name_tag, angles);
             }
         } else {
             // not moving anymore
-            if (was_moving && !local_terminating) {
+            if (was_moving && !terminating) {
                 // just finished moving due to a normal command that isnt terminate
-                printf("[%-8s] idle:", name_tag);
-                for (int i = 0; i < num; i++) {
-                    printf(" [%3d]", angles[i]);
-                }
-                printf("\n");
+                AsyncLog_printf("[%-8s] idle:%s\n", name_tag, angles);
             }
         }
 
         was_moving = moving;
+
+        // without -d or -p the server expects a STATUS every tick so only those can go quiet
+        if (quiet && can_idle(&reporter)) {
+            idle = 1;
+        }
     }
 
     return NULL;
 }
 
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-b] [-d] [-t deg] [-H ms] [-p deg] [-g tags] [-l level] <server_host> <port> <flower_name> <num_petals>\n"
+            "       %s -n count [-w workers] [options] <server_host> <port> <name_prefix> <num_petals>\n"
+            "       %s -f file [-w workers] [options] <server_host> <port>\n"
+            "  -b     send binary status frames instead of text lines\n"
+            "  -d     only report petals that changed, plus a full status as heartbeat\n"
+            "  -t deg smallest angle change worth reporting in -d mode (default 1)\n"
+            "  -H ms  heartbeat interval in -d / -p mode (default 2000)\n"
+            "  -p deg let the server predict our pose, only correct it when off by deg or more\n"
+            "         (single flower only, hosted flowers always report)\n"
+            "  -g     comma separated tags the server can group us by, like row3,north-bed\n"
+            "  -n     host count flowers in this process, named <name_prefix>0, <name_prefix>1, ...\n"
+            "  -f     host every flower listed in file, one \"<name> <num_petals> [tags]\" per line\n"
+            "  -w     worker threads stepping hosted flowers (default one per cpu)\n"
+            "  -l     error, warn, info (default) or debug, warn keeps the petal angles quiet\n",
+            prog, prog, prog);
+    exit(0);
+}
+
+// -n / -f, many flowers in this one process (see flower_host.c)
+static int run_host_mode(int argc, char **argv, int host_count, const char *host_file, int workers,
+                         const char *tags) {
+    FlowerHostSpec *specs = NULL;
+    int count = 0;
+
+    if (host_file != NULL) {
+        if (argc - optind != 2) usage(argv[0]);
+        count = FlowerHost_loadSpecs(host_file, tags, &specs);
+        if (count <= 0) {
+            printf("No usable flowers in %s\n", host_file);
+            return 1;
+        }
+    } else {
+        if (argc - optind != 4) usage(argv[0]);
+        const char *prefix = argv[optind + 2];
+        int num_petals = atoi(argv[optind + 3]);
+        if (num_petals <= 0 || num_petals > FLOWER_MAX_PETALS) {
+            printf("Invalid num_petals (1..%d)\n", FLOWER_MAX_PETALS);
+            return 1;
+        }
+        specs = calloc((size_t)host_count, sizeof(FlowerHostSpec));
+        if (specs == NULL) {
+            printf("Could not allocate %d flowers\n", host_count);
+            return 1;
+        }
+        for (int i = 0; i < host_count; i++) {
+            snprintf(specs[i].name, sizeof(specs[i].name), "%.20s%d", prefix, i);
+            specs[i].num_petals = num_petals;
+            snprintf(specs[i].tags, sizeof(specs[i].tags), "%s", tags ? tags : "");
+        }
+        count = host_count;
+    }
+
+    FlowerHostOptions opt;
+    opt.host = argv[optind];
+    opt.port = argv[optind + 1];
+    opt.want_bin = want_bin;
+    opt.delta_mode = delta_mode;
+    opt.delta_threshold_deg = delta_threshold_deg;
+    opt.heartbeat_ms = heartbeat_ms;
+    opt.workers = workers;
+
+    AsyncLog_start(stdout, 64 * 1024);
+    int rc = FlowerHost_run(&opt, specs, count);
+    unsigned long dropped = AsyncLog_stop();
+    if (dropped > 0) {
+        printf("(%lu console lines dropped, output could not keep up)\n", dropped);
+    }
+    free(specs);
+    return rc;
+}
+
 int main(int argc, char **argv) {
-    if (argc != 5) {
-        fprintf(stderr,
-                "Usage: %s <server_host> <port> <flower_name> <num_petals>\n",
-                argv[0]);
-        exit(0);
+    int opt;
+    int host_count = 0;
+    const char *host_file = NULL;
+    const char *tags = NULL;
+    int workers = 0;
+    while ((opt = getopt(argc, argv, "bdt:H:p:g:n:f:w:l:")) != -1) {
+        switch (opt) {
+        case 'b':
+            want_bin = 1;
+            break;
+        case 'd':
+            delta_mode = 1;
+            break;
+        case 't':
+            delta_threshold_deg = atoi(optarg);
+            break;
+        case 'H':
+            heartbeat_ms = atoi(optarg);
+            break;
+        case 'p':
+            want_predict = 1;
+            predict_error_deg = atoi(optarg);
+            if (predict_error_deg < 1) predict_error_deg = 1;
+            break;
+        case 'g':
+            tags = optarg;
+            break;
+        case 'n':
+            host_count = atoi(optarg);
+            if (host_count < 1) usage(argv[0]);
+            break;
+        case 'f':
+            host_file = optarg;
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            break;
+        case 'l': {
+            LogLevel level;
+            if (!AsyncLog_parseLevel(optarg, &level)) usage(argv[0]);
+            AsyncLog_setLevel(level);
+            break;
+        }
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (host_count > 0 || host_file != NULL) {
+        // flower_host.c has no copy of the servers model to check a prediction against
+        if (want_predict) {
+            fprintf(stderr, "-p cannot be used with -n / -f\n");
+            usage(argv[0]);
+        }
+        return run_host_mode(argc, argv, host_count, host_file, workers, tags);
+    }
+    if (argc - optind != 4) {
+        usage(argv[0]);
     }
 
-    char *server      = argv[1];
-    char *port        = argv[2];
-    char *flower_name = argv[3];
-    int   num_petals  = atoi(argv[4]);
+    char *server      = argv[optind];
+    char *port        = argv[optind + 1];
+    char *flower_name = argv[optind + 2];
+    int   num_petals  = atoi(argv[optind + 3]);
 
     if (num_petals <= 0 || num_petals > FLOWER_MAX_PETALS) {
         printf("Invalid num_petals (1..%d)\n", FLOWER_MAX_PETALS);
@@ -292,16 +798,30 @@ int main(int argc, char **argv) {
 
     // set up the internal flower model with its name and # of petals
     Flower_init(&g_flower, flower_name, num_petals);
+    publish_snapshot();
+    CmdQueue_init(&cmdq);
+    ClockSync_init(&clock_sync);
 
     // print initial state so its clear where were starting from
     print_flower_snapshot("initial");
 
     // send HELLO so the server can register this flower in its garden table
-    char hello[128];
+    char hello[256];
     snprintf(hello, sizeof(hello),
-             "HELLO name=%s num_petals=%d\n", flower_name, num_petals);
+             "HELLO name=%s num_petals=%d%s%s%s%.200s\n", flower_name, num_petals,
+             want_bin ? " proto=bin" : "", want_predict ? " predict=1" : "",
+             tags ? " tags=" : "", tags ? tags : "");
     sendLine(hello);
 
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&motion_cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    // from here on the threads print, so everything goes through the writer thread
+    AsyncLog_start(stdout, 64 * 1024);
+
     // one thread for listening to server commands one for motion and satus
     pthread_t recv_tid, motion_tid;
     pthread_create(&recv_tid, NULL, receiver_thread, NULL);
@@ -311,6 +831,10 @@ int main(int argc, char **argv) {
     pthread_join(motion_tid, NULL);
 
     Close(connfd);
-    printf("Flower '%s' shutting down.\n", flower_name);
+    unsigned long dropped = AsyncLog_stop();
+    if (dropped > 0) {
+        printf("(%lu console lines dropped, output could not keep up)\n", dropped);
+    }
+    printf("Flower '%s' shutting down (%lu status reports sent).\n", flower_name, reports_sent);
     return 0;
 }
\ No newline at end of file
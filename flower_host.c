@@ -0,0 +1,508 @@
+// flower_host.c
+// host mode for flower_client, a lot of flowers in one process instead of one process per flower
+
+// one epoll thread reads the commands for every flower and a small pool of workers steps them,
+// each worker owns a fixed slice of the flowers and writes their status to the sockets itself
+// so the only thing the two sides ever share is the flower lock
+// the flower logic is the exact same flower.c the single client uses
+
+#include "csapp.h"
+#include "flower.h"
+#include "flower_host.h"
+#include "ringbuf.h"
+#include "ticker.h"
+#include "clocksync.h"
+#include "asynclog.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#define HOST_TICK_MS      100    // same grid as the single flower motion thread
+#define HOST_MAX_CATCHUP  2000
+#define HOST_EVENTS       256
+#define HOST_IN_SIZE      1024
+#define HOST_MAX_LINE     FLOWER_CMD_MAX
+#define HOST_OUT_SIZE     1024   // status bytes a full socket has not taken yet
+#define HOST_MAX_WORKERS  64
+#define HOST_STATS_EVERY  5      // seconds between summary lines
+#define HOST_RESYNC_MS    10000  // between clock sync pings per flower, the first goes out on the first tick
+#define HOST_HELD_MAX     4      // timed commands one flower can have waiting, a FlowerCmd is big
+
+typedef struct {
+    pthread_mutex_t lock;        // guards everything below except in, which is io thread only
+    Flower   f;
+    FlowerReporter reporter;
+    int      fd;
+    int      proto_bin;
+    uint32_t id;
+    int      terminating;
+    int      finished;           // closed after TERMINATE, waiting for the io thread to drop it
+    int      closed;             // socket is gone, nothing left to do
+    char     out[HOST_OUT_SIZE];
+    size_t   out_len;
+    FlowerCmd held[HOST_HELD_MAX];      // timed commands waiting for their start time
+    int64_t  held_ms[HOST_HELD_MAX];    // when, on our clock, soonest first
+    int      held_count;
+    int64_t  next_sync_ms;
+    RingBuf  in;
+    ClockSync clock;             // io thread only, like in
+} HostedFlower;
+
+static const FlowerHostOptions *options;
+static HostedFlower *flowers = NULL;
+static int           num_flowers = 0;
+static int           num_workers = 1;
+static int           epfd = -1;
+
+static atomic_int   flowers_left;
+static atomic_int   worker_moving[HOST_MAX_WORKERS];   // moving flowers each worker saw last tick
+static atomic_ulong stat_sent;
+static atomic_ulong stat_dropped;
+static atomic_ulong stat_commands;
+
+int FlowerHost_loadSpecs(const char *path, const char *default_tags, FlowerHostSpec **out) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return -1;
+
+    FlowerHostSpec *specs = NULL;
+    int count = 0;
+    int cap = 0;
+    char line[256];
+    int lineno = 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash != NULL) *hash = '\0';
+
+        char name[64];
+        int petals;
+        char tags[128];
+        int got = sscanf(line, "%63s %d %127s", name, &petals, tags);
+        if (got <= 0) continue;   // blank or comment
+
+        if (got < 2 || petals <= 0 || petals > FLOWER_MAX_PETALS || strlen(name) >= 32) {
+            printf("%s:%d: expected \"<name> <num_petals> [tags]\" with 1..%d petals\n",
+                   path, lineno, FLOWER_MAX_PETALS);
+            free(specs);
+            fclose(fp);
+            return -1;
+        }
+
+        if (count == cap) {
+            int new_cap = cap ? cap * 2 : 64;
+            FlowerHostSpec *grown = realloc(specs, (size_t)new_cap * sizeof(FlowerHostSpec));
+            if (grown == NULL) {
+                free(specs);
+                fclose(fp);
+                return -1;
+            }
+            specs = grown;
+            cap = new_cap;
+        }
+        strcpy(specs[count].name, name);
+        specs[count].num_petals = petals;
+        snprintf(specs[count].tags, sizeof(specs[count].tags), "%s",
+                 got == 3 ? tags : (default_tags ? default_tags : ""));
+        count++;
+    }
+
+    fclose(fp);
+    *out = specs;
+    return count;
+}
+
+// one write attempt, whatever the socket does not take waits in hf->out for the next tick
+// a status that does not fit behind the waiting bytes is dropped as a whole, never cut
+// expects hf->lock to be held
+static void host_send(HostedFlower *hf, const void *buf, size_t len) {
+    if (hf->out_len > 0) {
+        ssize_t n = send(hf->fd, hf->out, hf->out_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            memmove(hf->out, hf->out + n, hf->out_len - (size_t)n);
+            hf->out_len -= (size_t)n;
+        }
+    }
+    if (len == 0) return;
+
+    size_t sent = 0;
+    if (hf->out_len == 0) {
+        ssize_t n = send(hf->fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) sent = (size_t)n;
+    } else if (len > sizeof(hf->out) - hf->out_len) {
+        atomic_fetch_add_explicit(&stat_dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    // when nothing was waiting the leftover always fits, the buffer is bigger than any status
+    memcpy(hf->out + hf->out_len, (const char *)buf + sent, len - sent);
+    hf->out_len += len - sent;
+    atomic_fetch_add_explicit(&stat_sent, 1, memory_order_relaxed);
+}
+
+static int64_t host_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// server side of the socket is gone (or we finished), only the io thread calls this
+static void host_drop(HostedFlower *hf) {
+    pthread_mutex_lock(&hf->lock);
+    if (!hf->closed) {
+        hf->closed = 1;
+        epoll_ctl(epfd, EPOLL_CTL_DEL, hf->fd, NULL);
+        close(hf->fd);
+        atomic_fetch_sub(&flowers_left, 1);
+    }
+    pthread_mutex_unlock(&hf->lock);
+}
+
+// expects hf->lock to be held
+static void host_apply(HostedFlower *hf, const FlowerCmd *c) {
+    Flower_applyCmd(&hf->f, c);   // TERMINATE closes
+    if (c->op == FLOWER_OP_TERMINATE) hf->terminating = 1;
+}
+
+// puts a timed command into the held list, kept sorted by start time so the worker only ever
+// looks at the front, commands with the same start time stay in the order they came in
+// when the list is full the command that would start last is dropped, starting one early
+// would put the flower somewhere the server does not think it is
+// expects hf->lock to be held
+static void host_hold(HostedFlower *hf, const FlowerCmd *c, int64_t due_ms) {
+    if (hf->held_count == HOST_HELD_MAX) {
+        int last = HOST_HELD_MAX - 1;
+        int keep_new = due_ms < hf->held_ms[last];
+        AsyncLog_log(LOG_LEVEL_WARN, "[host] too many timed commands waiting, dropping %s\n",
+                     Flower_opName(keep_new ? hf->held[last].op : c->op));
+        if (!keep_new) return;
+        hf->held_count--;
+    }
+
+    int i = hf->held_count;
+    while (i > 0 && hf->held_ms[i - 1] > due_ms) {
+        hf->held[i]    = hf->held[i - 1];
+        hf->held_ms[i] = hf->held_ms[i - 1];
+        i--;
+    }
+    hf->held[i]    = *c;
+    hf->held_ms[i] = due_ms;
+    hf->held_count++;
+}
+
+// same commands the single flower understands, minus all the printing
+// due_ms is when a timed command starts on our clock (0 for right away), the worker applies
+// it on the tick after that and steps the motion as if it had started right on time
+static void host_handle_cmd(HostedFlower *hf, const FlowerCmd *c, int64_t due_ms) {
+    atomic_fetch_add_explicit(&stat_commands, 1, memory_order_relaxed);
+
+    pthread_mutex_lock(&hf->lock);
+    if (due_ms > host_now_ms()) {
+        host_hold(hf, c, due_ms);
+    } else {
+        host_apply(hf, c);
+    }
+    pthread_mutex_unlock(&hf->lock);
+}
+
+// lines that are not flower commands, only PROTO matters here
+static void host_handle_line(HostedFlower *hf, const char *line) {
+    while (*line == ' ' || *line == '\t') line++;
+
+    if (strncmp(line, "PROTO bin id=", 13) == 0) {
+        pthread_mutex_lock(&hf->lock);
+        hf->id = (uint32_t)strtoul(line + 13, NULL, 10);
+        hf->proto_bin = 1;
+        pthread_mutex_unlock(&hf->lock);
+    }
+}
+
+// returns 0 if the connection is done
+// text lines and (once we asked for proto=bin) command frames, both handled in place in the ring
+static int host_read(HostedFlower *hf) {
+    ssize_t n = RingBuf_readFrom(&hf->in, hf->fd);
+    if (n == 0) return 0;
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+
+    while (1) {
+        const unsigned char *p = (const unsigned char *)RingBuf_peek(&hf->in, 1);
+        if (p == NULL) break;
+
+        if (options->want_bin && p[0] == FLOWER_FRAME_MAGIC) {
+            p = (const unsigned char *)RingBuf_peek(&hf->in, FLOWER_FRAME_HEADER);
+            if (p == NULL) break;
+            size_t flen = Flower_frameLength(p, FLOWER_FRAME_HEADER);
+            if (flen < FLOWER_FRAME_HEADER || flen > FLOWER_FRAME_MAX) return 0;
+            p = (const unsigned char *)RingBuf_peek(&hf->in, flen);
+            if (p == NULL) break;
+            FlowerCmd c;
+            c.op = Flower_decodeCommand(p, flen);
+            RingBuf_consume(&hf->in, flen);
+            if (c.op != FLOWER_OP_NONE) host_handle_cmd(hf, &c, 0);
+            continue;
+        }
+
+        const char *line;
+        size_t len;
+        int rc = RingBuf_nextLine(&hf->in, &line, &len);
+        if (rc == 0) break;
+        if (rc < 0 || len == 0) continue;
+        if (ClockSync_reply(&hf->clock, line, len, host_now_ms())) continue;
+
+        int64_t at;
+        size_t cmd_len = len;
+        int timed = Flower_splitStartTime(line, &cmd_len, &at) && ClockSync_synced(&hf->clock);
+        FlowerCmd c;
+        if (Flower_parseCommand(line, cmd_len, &c) != FLOWER_OP_NONE) {
+            host_handle_cmd(hf, &c, timed ? ClockSync_toLocal(&hf->clock, at) : 0);
+        } else {
+            host_handle_line(hf, line);
+        }
+    }
+    return 1;
+}
+
+static void* host_io_thread(void *arg) {
+    (void)arg;
+    struct epoll_event events[HOST_EVENTS];
+
+    while (atomic_load(&flowers_left) > 0) {
+        int n = epoll_wait(epfd, events, HOST_EVENTS, 200);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            AsyncLog_log(LOG_LEVEL_ERROR, "[host] epoll_wait failed\n");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            HostedFlower *hf = events[i].data.ptr;
+            int keep = 1;
+            if (events[i].events & EPOLLIN) {
+                keep = host_read(hf);
+            } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                keep = 0;
+            }
+            if (!keep) host_drop(hf);
+        }
+    }
+    return NULL;
+}
+
+// moves the flower dt_ms forward in HOST_TICK_MS pieces, expects hf->lock to be held
+static void host_move(HostedFlower *hf, int dt_ms) {
+    for (int left = dt_ms; left > 0; left -= HOST_TICK_MS) {
+        Flower_update(&hf->f, left < HOST_TICK_MS ? left : HOST_TICK_MS);
+    }
+}
+
+// one tick for one flower, this is the motion thread of the single client squeezed into a function
+// dt_ms is the real time up to now since the last tick, stepped in HOST_TICK_MS pieces like the
+// single client, held commands that came due in there go in at their start times, in order
+// returns 1 if the flower is moving
+static int host_step(HostedFlower *hf, int dt_ms, int64_t now) {
+    unsigned char buf[256];
+    size_t len = 0;
+    int moving = 0;
+
+    pthread_mutex_lock(&hf->lock);
+    if (hf->closed || hf->finished) {
+        pthread_mutex_unlock(&hf->lock);
+        return 0;
+    }
+
+    // the motion is split at every start time, from is how far it has been moved so far
+    int64_t from = now - dt_ms;
+    while (hf->held_count > 0 && hf->held_ms[0] <= now) {
+        if (hf->held_ms[0] > from) {
+            host_move(hf, (int)(hf->held_ms[0] - from));
+            from = hf->held_ms[0];
+        }
+        host_apply(hf, &hf->held[0]);
+        hf->held_count--;
+        memmove(&hf->held[0], &hf->held[1], hf->held_count * sizeof(hf->held[0]));
+        memmove(&hf->held_ms[0], &hf->held_ms[1], hf->held_count * sizeof(hf->held_ms[0]));
+    }
+    host_move(hf, (int)(now - from));
+
+    if (now >= hf->next_sync_ms) {
+        char req[48];
+        host_send(hf, req, ClockSync_request(req, sizeof(req), now));
+        hf->next_sync_ms = now + HOST_RESYNC_MS;
+    }
+
+    unsigned mask = 0;
+    int report = options->delta_mode ? FlowerReporter_step(&hf->reporter, &hf->f, dt_ms, &mask)
+                                     : FLOWER_REPORT_FULL;
+    if (report == FLOWER_REPORT_FULL) {
+        if (hf->proto_bin) {
+            len = Flower_encodeStatus(&hf->f, hf->id, buf, sizeof(buf));
+        } else {
+            Flower_buildStatus(&hf->f, (char *)buf, sizeof(buf));
+            len = strlen((char *)buf);
+        }
+    } else if (report == FLOWER_REPORT_DELTA) {
+        if (hf->proto_bin) {
+            len = Flower_encodeDelta(&hf->f, hf->id, mask, buf, sizeof(buf));
+        } else {
+            Flower_buildDelta(&hf->f, mask, (char *)buf, sizeof(buf));
+            len = strlen((char *)buf);
+        }
+    }
+    host_send(hf, buf, len);
+
+    moving = Flower_isMoving(&hf->f);
+    if (hf->terminating && !moving) {
+        // all closed up, the io thread sees the shutdown and drops the socket
+        hf->finished = 1;
+        shutdown(hf->fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&hf->lock);
+
+    return moving;
+}
+
+static void* host_worker_thread(void *arg) {
+    int w = (int)(intptr_t)arg;
+    int first = (int)((int64_t)num_flowers * w / num_workers);
+    int last  = (int)((int64_t)num_flowers * (w + 1) / num_workers);
+
+    // absolute deadlines so the time a big slice takes to step does not stretch the tick
+    Ticker ticker;
+    Ticker_init(&ticker, HOST_TICK_MS, HOST_MAX_CATCHUP);
+
+    while (atomic_load(&flowers_left) > 0) {
+        int dt_ms = Ticker_wait(&ticker);
+        int64_t now = host_now_ms();
+
+        int moving = 0;
+        for (int i = first; i < last; i++) {
+            moving += host_step(&flowers[i], dt_ms, now);
+        }
+        atomic_store(&worker_moving[w], moving);
+    }
+    return NULL;
+}
+
+// thousands of sockets need more than the usual 1024 descriptors
+static void host_raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// connect and say HELLO while the socket is still blocking, then hand it to epoll
+static int host_connect(HostedFlower *hf, const FlowerHostSpec *spec) {
+    pthread_mutex_init(&hf->lock, NULL);
+    Flower_init(&hf->f, spec->name, spec->num_petals);
+    FlowerReporter_init(&hf->reporter, options->delta_threshold_deg, options->heartbeat_ms);
+    ClockSync_init(&hf->clock);
+    hf->closed = 1;
+
+    if (!RingBuf_init(&hf->in, HOST_IN_SIZE, HOST_MAX_LINE)) return 0;
+
+    hf->fd = open_clientfd((char *)options->host, (char *)options->port);
+    if (hf->fd < 0) return 0;
+
+    char hello[256];
+    int len = snprintf(hello, sizeof(hello), "HELLO name=%s num_petals=%d%s%s%s\n",
+                       spec->name, spec->num_petals, options->want_bin ? " proto=bin" : "",
+                       spec->tags[0] ? " tags=" : "", spec->tags);
+    if (send(hf->fd, hello, (size_t)len, MSG_NOSIGNAL) != len) {
+        close(hf->fd);
+        return 0;
+    }
+
+    int flags = fcntl(hf->fd, F_GETFL, 0);
+    fcntl(hf->fd, F_SETFL, flags | O_NONBLOCK);
+
+    struct epoll_event ev;
+    ev.events   = EPOLLIN;
+    ev.data.ptr = hf;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, hf->fd, &ev) < 0) {
+        close(hf->fd);
+        return 0;
+    }
+
+    hf->closed = 0;
+    return 1;
+}
+
+int FlowerHost_run(const FlowerHostOptions *opt, const FlowerHostSpec *specs, int count) {
+    options = opt;
+    num_flowers = count;
+    num_workers = opt->workers;
+    if (num_workers <= 0) num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers < 1) num_workers = 1;
+    if (num_workers > HOST_MAX_WORKERS) num_workers = HOST_MAX_WORKERS;
+    if (num_workers > count) num_workers = count;
+
+    host_raise_fd_limit();
+
+    flowers = calloc((size_t)count, sizeof(HostedFlower));
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (flowers == NULL || epfd < 0) {
+        AsyncLog_log(LOG_LEVEL_ERROR, "[host] could not set up for %d flowers\n", count);
+        return 1;
+    }
+
+    int connected = 0;
+    for (int i = 0; i < count; i++) {
+        if (host_connect(&flowers[i], &specs[i])) {
+            connected++;
+        } else {
+            AsyncLog_log(LOG_LEVEL_WARN, "[host] could not connect flower '%s'\n",
+                         specs[i].name);
+        }
+    }
+    atomic_store(&flowers_left, connected);
+
+    AsyncLog_printf("Hosting %d of %d flowers on %s:%s with %d worker%s.\n",
+                    connected, count, opt->host, opt->port, num_workers, num_workers == 1 ? "" : "s");
+    if (connected == 0) return 1;
+
+    pthread_t io_tid;
+    pthread_t worker_tids[HOST_MAX_WORKERS];
+    pthread_create(&io_tid, NULL, host_io_thread, NULL);
+    for (int w = 0; w < num_workers; w++) {
+        pthread_create(&worker_tids[w], NULL, host_worker_thread, (void *)(intptr_t)w);
+    }
+
+    // main thread just keeps an eye on things until every flower is gone
+    int ticks = 0;
+    while (atomic_load(&flowers_left) > 0) {
+        sleep(1);
+        if (++ticks % HOST_STATS_EVERY != 0) continue;
+
+        int moving = 0;
+        for (int w = 0; w < num_workers; w++) moving += atomic_load(&worker_moving[w]);
+        AsyncLog_printf("[host] connected=%d moving=%d sent=%lu dropped=%lu commands=%lu\n",
+                        atomic_load(&flowers_left), moving,
+                        atomic_load(&stat_sent), atomic_load(&stat_dropped), atomic_load(&stat_commands));
+    }
+
+    pthread_join(io_tid, NULL);
+    for (int w = 0; w < num_workers; w++) {
+        pthread_join(worker_tids[w], NULL);
+    }
+
+    for (int i = 0; i < count; i++) {
+        RingBuf_free(&flowers[i].in);
+        pthread_mutex_destroy(&flowers[i].lock);
+    }
+    free(flowers);
+    close(epfd);
+
+    AsyncLog_printf("All %d hosted flowers are done.\n", connected);
+    return 0;
+}
@@ -0,0 +1,33 @@
+// flower_host.h
+// one process hosting a whole bunch of flowers, used to put real load on the garden server
+// every flower still has its own socket and its own Flower, they just share the threads
+
+#ifndef FLOWER_HOST_H
+#define FLOWER_HOST_H
+
+typedef struct {
+    const char *host;
+    const char *port;
+    int want_bin;              // same meaning as the single flower -b / -d / -t / -H options
+    int delta_mode;
+    int delta_threshold_deg;
+    int heartbeat_ms;
+    int workers;               // threads stepping flowers, 0 picks one per cpu
+} FlowerHostOptions;
+
+typedef struct {
+    char name[32];
+    int  num_petals;
+    char tags[128];            // comma separated, sent as tags= in HELLO when not empty
+} FlowerHostSpec;
+
+// reads a flower list, one "<name> <num_petals> [<tag>,<tag>...]" per line, # starts a comment
+// flowers without a tag column get default_tags (which may be NULL)
+// returns how many were read (*out is malloced) or -1 if the file is unusable
+int FlowerHost_loadSpecs(const char *path, const char *default_tags, FlowerHostSpec **out);
+
+// connects every flower and runs them until they are all terminated or disconnected
+// returns 0 if at least one flower connected
+int FlowerHost_run(const FlowerHostOptions *opt, const FlowerHostSpec *specs, int count);
+
+#endif
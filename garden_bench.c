@@ -0,0 +1,495 @@
+// garden_bench.c
+// load test for garden_server, `make bench` runs it
+//
+// starts a real garden_server on loopback, attaches N simulated flowers from this one process
+// and measures, for every N asked for:
+//   - how fast flowers can connect and get registered
+//   - how many STATUS lines per second the server takes in
+//   - how long a console command takes to reach every flower (p50 / p99 / p999)
+//   - server CPU time for each of those phases and its resident memory
+// results go out as JSON so they can be kept and compared between versions
+//
+// the simulated flowers are just sockets, there is no motion behind them, the status lines
+// they send are built by the real flower.c so the server parses exactly what it normally gets
+//
+// every phase ends with the same trick: each flower sends "TIME 0" after its work and waits
+// for the reply, the server handles one connection in order so a reply means everything
+// sent before it was processed
+
+#include "flower.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define BENCH_MAX_RUNS     16
+#define BENCH_WAIT_MS      30000   // longest any phase may take before the run is given up
+#define BENCH_IN_SIZE      512
+
+typedef struct {
+    int     fd;
+    char    in[BENCH_IN_SIZE];
+    size_t  in_len;
+    int     got;          // phase specific, 1 once the line the phase waits for came in
+    int64_t got_ns;
+} BenchFlower;
+
+typedef struct {
+    int     flowers;
+    int     connected;
+    double  connect_per_sec;
+    double  status_per_sec;
+    int     samples;
+    double  p50_us, p99_us, p999_us, max_us;
+    double  cpu_connect_ms, cpu_status_ms, cpu_command_ms;
+    long    rss_kb, peak_rss_kb;
+    int     failed;       // a phase timed out, numbers after it are missing
+} BenchRun;
+
+static const char *server_path = "./garden_server";
+static int   reactors = 1;
+static int   status_per_flower = 50;
+static int   rounds = 20;
+static int   base_port = 15900;
+
+static pid_t server_pid = -1;
+static int   server_in = -1;   // console pipe
+static int   epfd = -1;
+
+static int64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// the flower sockets are non-blocking so reads can drain them, writes just wait for room
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { fd, POLLOUT, 0 };
+                poll(&pfd, 1, 100);
+                continue;
+            }
+            return 0;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+static int connect_loopback(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons((uint16_t)port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// server CPU time so far (user + system) in ms, from /proc
+static double server_cpu_ms(void) {
+    char path[64];
+    char buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)server_pid);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return 0.0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+
+    // the command name can have spaces in it, the fields we want come after its closing paren
+    char *p = strrchr(buf, ')');
+    if (p == NULL) return 0.0;
+    unsigned long utime = 0, stime = 0;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return 0.0;
+    }
+    return (double)(utime + stime) * 1000.0 / (double)sysconf(_SC_CLK_TCK);
+}
+
+// VmRSS or VmHWM of the server in kB
+static long server_mem_kb(const char *field) {
+    char path[64];
+    char line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)server_pid);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return 0;
+    long kb = 0;
+    size_t flen = strlen(field);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, field, flen) == 0 && line[flen] == ':') {
+            kb = atol(line + flen + 1);
+            break;
+        }
+    }
+    fclose(fp);
+    return kb;
+}
+
+// starts garden_server on port with its console on a pipe and its output thrown away
+// returns once it accepts connections
+static int start_server(int port) {
+    int pfd[2];
+    if (pipe(pfd) < 0) return 0;
+
+    char port_s[16], reactors_s[16];
+    snprintf(port_s, sizeof(port_s), "%d", port);
+    snprintf(reactors_s, sizeof(reactors_s), "%d", reactors);
+
+    server_pid = fork();
+    if (server_pid < 0) return 0;
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(pfd[0], 0);
+        dup2(devnull, 1);
+        dup2(devnull, 2);
+        close(pfd[0]);
+        close(pfd[1]);
+        execl(server_path, server_path, "-r", reactors_s, port_s, (char *)NULL);
+        _exit(127);
+    }
+    close(pfd[0]);
+    server_in = pfd[1];
+
+    for (int tries = 0; tries < 500; tries++) {
+        int fd = connect_loopback(port);
+        if (fd >= 0) {
+            // that one says nothing and goes away, the server just drops it
+            close(fd);
+            return 1;
+        }
+        usleep(10000);
+    }
+    return 0;
+}
+
+static void stop_server(void) {
+    if (server_in >= 0) close(server_in);
+    server_in = -1;
+    if (server_pid > 0) {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+    }
+    server_pid = -1;
+}
+
+// reads whatever is there for one flower and marks it once a line starting with want shows up
+static void bench_read(BenchFlower *bf, const char *want) {
+    while (1) {
+        ssize_t n = read(bf->fd, bf->in + bf->in_len, sizeof(bf->in) - bf->in_len);
+        if (n <= 0) return;
+        bf->in_len += (size_t)n;
+
+        char *start = bf->in;
+        char *nl;
+        while ((nl = memchr(start, '\n', bf->in_len - (size_t)(start - bf->in))) != NULL) {
+            if (!bf->got && strncmp(start, want, strlen(want)) == 0) {
+                bf->got = 1;
+                bf->got_ns = mono_ns();
+            }
+            start = nl + 1;
+        }
+        bf->in_len -= (size_t)(start - bf->in);
+        memmove(bf->in, start, bf->in_len);
+        if (bf->in_len == sizeof(bf->in)) bf->in_len = 0;   // nobody sends lines this long
+    }
+}
+
+// waits until every flower saw a line starting with want, returns 0 on timeout
+static int wait_all(BenchFlower *fl, int n, const char *want) {
+    struct epoll_event events[256];
+    int left = 0;
+    for (int i = 0; i < n; i++) {
+        if (!fl[i].got) left++;
+    }
+    int64_t give_up = mono_ns() + (int64_t)BENCH_WAIT_MS * 1000000LL;
+
+    while (left > 0) {
+        int ready = epoll_wait(epfd, events, 256, 100);
+        if (ready < 0 && errno != EINTR) return 0;
+        for (int e = 0; e < ready; e++) {
+            BenchFlower *bf = events[e].data.ptr;
+            int had = bf->got;
+            bench_read(bf, want);
+            if (!had && bf->got) left--;
+        }
+        if (mono_ns() > give_up) return 0;
+    }
+    return 1;
+}
+
+static void reset_got(BenchFlower *fl, int n) {
+    for (int i = 0; i < n; i++) fl[i].got = 0;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, double p) {
+    if (n == 0) return 0.0;
+    int i = (int)(p * (double)(n - 1) + 0.5);
+    return sorted[i];
+}
+
+// one full run against a fresh server with n flowers
+static void bench_run(int n, int port, BenchRun *out) {
+    memset(out, 0, sizeof(*out));
+    out->flowers = n;
+
+    if (!start_server(port)) {
+        printf("could not start %s on port %d\n", server_path, port);
+        out->failed = 1;
+        stop_server();
+        return;
+    }
+
+    BenchFlower *fl = calloc((size_t)n, sizeof(BenchFlower));
+    double *lat = malloc((size_t)n * (size_t)rounds * sizeof(double));
+    epfd = epoll_create1(0);
+    if (fl == NULL || lat == NULL || epfd < 0) {
+        printf("out of memory for %d flowers\n", n);
+        out->failed = 1;
+        goto done;
+    }
+
+    // connect: socket + HELLO for everybody, done once every flower got its TIME reply back
+    double cpu0 = server_cpu_ms();
+    int64_t t0 = mono_ns();
+    for (int i = 0; i < n; i++) {
+        fl[i].fd = connect_loopback(port);
+        if (fl[i].fd < 0) break;
+        char hello[96];
+        int len = snprintf(hello, sizeof(hello), "HELLO name=bench%d num_petals=5\nTIME 0\n", i);
+        write_all(fl[i].fd, hello, (size_t)len);
+        fcntl(fl[i].fd, F_SETFL, fcntl(fl[i].fd, F_GETFL, 0) | O_NONBLOCK);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &fl[i];
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fl[i].fd, &ev);
+        out->connected++;
+    }
+    if (out->connected < n || !wait_all(fl, n, "TIME")) {
+        printf("  only %d of %d flowers connected\n", out->connected, n);
+        out->failed = 1;
+        goto done;
+    }
+    out->connect_per_sec = (double)n / ((double)(mono_ns() - t0) / 1e9);
+    double cpu1 = server_cpu_ms();
+    out->cpu_connect_ms = cpu1 - cpu0;
+
+    // status ingest: every flower sends its batch of STATUS lines in one go
+    {
+        Flower f;
+        Flower_init(&f, "bench", 5);
+        Flower_applyCommand(&f, "OPEN");
+        Flower_update(&f, 300);
+        char line[256];
+        Flower_buildStatus(&f, line, sizeof(line));
+        size_t llen = strlen(line);
+
+        size_t blen = llen * (size_t)status_per_flower + 8;
+        char *batch = malloc(blen);
+        if (batch == NULL) {
+            out->failed = 1;
+            goto done;
+        }
+        for (int k = 0; k < status_per_flower; k++) memcpy(batch + llen * (size_t)k, line, llen);
+        memcpy(batch + llen * (size_t)status_per_flower, "TIME 0\n", 7);
+        blen = llen * (size_t)status_per_flower + 7;
+
+        reset_got(fl, n);
+        t0 = mono_ns();
+        for (int i = 0; i < n; i++) write_all(fl[i].fd, batch, blen);
+        free(batch);
+        if (!wait_all(fl, n, "TIME")) {
+            printf("  status phase timed out\n");
+            out->failed = 1;
+            goto done;
+        }
+        out->status_per_sec = (double)n * status_per_flower / ((double)(mono_ns() - t0) / 1e9);
+    }
+    double cpu2 = server_cpu_ms();
+    out->cpu_status_ms = cpu2 - cpu1;
+
+    // command latency: console line in, time until each flower has it
+    for (int r = 0; r < rounds; r++) {
+        const char *cmd = (r % 2 == 0) ? "OPEN all\n" : "CLOSE all\n";
+        reset_got(fl, n);
+        int64_t sent = mono_ns();
+        write_all(server_in, cmd, strlen(cmd));
+        if (!wait_all(fl, n, r % 2 == 0 ? "OPEN" : "CLOSE")) {
+            printf("  command round %d timed out\n", r);
+            out->failed = 1;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            lat[out->samples++] = (double)(fl[i].got_ns - sent) / 1000.0;
+        }
+        usleep(20000);
+    }
+    out->cpu_command_ms = server_cpu_ms() - cpu2;
+
+    qsort(lat, (size_t)out->samples, sizeof(double), cmp_double);
+    out->p50_us  = percentile(lat, out->samples, 0.50);
+    out->p99_us  = percentile(lat, out->samples, 0.99);
+    out->p999_us = percentile(lat, out->samples, 0.999);
+    out->max_us  = out->samples > 0 ? lat[out->samples - 1] : 0.0;
+
+done:
+    if (server_pid > 0) {
+        out->rss_kb = server_mem_kb("VmRSS");
+        out->peak_rss_kb = server_mem_kb("VmHWM");
+    }
+    stop_server();
+    if (fl != NULL) {
+        for (int i = 0; i < n; i++) {
+            if (fl[i].fd > 0) close(fl[i].fd);
+        }
+    }
+    if (epfd >= 0) close(epfd);
+    epfd = -1;
+    free(fl);
+    free(lat);
+}
+
+static void write_json(FILE *fp, const char *label, const BenchRun *runs, int count) {
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"bench\": \"garden_server\",\n");
+    fprintf(fp, "  \"label\": \"%s\",\n", label);
+    fprintf(fp, "  \"reactors\": %d,\n", reactors);
+    fprintf(fp, "  \"status_per_flower\": %d,\n", status_per_flower);
+    fprintf(fp, "  \"command_rounds\": %d,\n", rounds);
+    fprintf(fp, "  \"runs\": [\n");
+    for (int i = 0; i < count; i++) {
+        const BenchRun *r = &runs[i];
+        fprintf(fp, "    {\"flowers\": %d, \"connected\": %d, \"ok\": %s,\n",
+                r->flowers, r->connected, r->failed ? "false" : "true");
+        fprintf(fp, "     \"connect_per_sec\": %.1f, \"status_per_sec\": %.1f,\n",
+                r->connect_per_sec, r->status_per_sec);
+        fprintf(fp, "     \"command_latency_us\": {\"samples\": %d, \"p50\": %.1f, \"p99\": %.1f, "
+                    "\"p999\": %.1f, \"max\": %.1f},\n",
+                r->samples, r->p50_us, r->p99_us, r->p999_us, r->max_us);
+        fprintf(fp, "     \"server_cpu_ms\": {\"connect\": %.0f, \"status\": %.0f, \"command\": %.0f},\n",
+                r->cpu_connect_ms, r->cpu_status_ms, r->cpu_command_ms);
+        fprintf(fp, "     \"server_rss_kb\": %ld, \"server_peak_rss_kb\": %ld}%s\n",
+                r->rss_kb, r->peak_rss_kb, i + 1 < count ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-n counts] [-s server] [-r reactors] [-k statuses] [-c rounds] [-p port]\n"
+            "          [-t label] [-o file]\n"
+            "  -n  comma separated flower counts, one run each (default 100,1000)\n"
+            "  -s  garden_server binary (default ./garden_server)\n"
+            "  -r  reactors the server runs with (default 1)\n"
+            "  -k  STATUS lines every flower sends in the ingest phase (default 50)\n"
+            "  -c  OPEN / CLOSE rounds for the latency phase (default 20)\n"
+            "  -p  first port, every run uses the next one (default 15900)\n"
+            "  -t  label stored with the results, like a git revision\n"
+            "  -o  write the JSON there instead of stdout\n",
+            prog);
+    exit(0);
+}
+
+int main(int argc, char **argv) {
+    const char *counts = "100,1000";
+    const char *label = "";
+    const char *out_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:r:k:c:p:t:o:")) != -1) {
+        switch (opt) {
+        case 'n': counts = optarg; break;
+        case 's': server_path = optarg; break;
+        case 'r': reactors = atoi(optarg); break;
+        case 'k': status_per_flower = atoi(optarg); break;
+        case 'c': rounds = atoi(optarg); break;
+        case 'p': base_port = atoi(optarg); break;
+        case 't': label = optarg; break;
+        case 'o': out_path = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (reactors < 1) reactors = 1;
+    if (status_per_flower < 1) status_per_flower = 1;
+    if (rounds < 1) rounds = 1;
+
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit();
+
+    BenchRun runs[BENCH_MAX_RUNS];
+    int count = 0;
+    for (const char *p = counts; *p != '\0' && count < BENCH_MAX_RUNS; ) {
+        int n = atoi(p);
+        if (n > 0) {
+            printf("bench: %d flowers...\n", n);
+            fflush(stdout);
+            bench_run(n, base_port + count, &runs[count]);
+            const BenchRun *r = &runs[count];
+            printf("  connect %.0f/s  status %.0f/s  latency p50 %.0fus p99 %.0fus p999 %.0fus"
+                   "  rss %ld kB\n",
+                   r->connect_per_sec, r->status_per_sec, r->p50_us, r->p99_us, r->p999_us,
+                   r->peak_rss_kb);
+            count++;
+        }
+        p += strcspn(p, ",");
+        if (*p == ',') p++;
+    }
+
+    FILE *fp = stdout;
+    if (out_path != NULL) {
+        fp = fopen(out_path, "w");
+        if (fp == NULL) {
+            printf("could not write %s\n", out_path);
+            return 1;
+        }
+    }
+    write_json(fp, label, runs, count);
+    if (fp != stdout) {
+        fclose(fp);
+        printf("results written to %s\n", out_path);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (runs[i].failed) return 1;
+    }
+    return 0;
+}
@@ -1,5 +1,5 @@
 // garden_server.c
-// behold my little garden server that controls up to 64 of flower clients at once
+// behold my little garden server that controls a whole lot of flower clients at once
 
 #include "csapp.h"
 #include <pthread.h>
@@ -8,21 +8,301 @@
 #include <string.h>
 #include <time.h>
 #include <ctype.h>   // for toupper
-
-#define MAX_FLOWERS 64
-
-// each flower that connects gets one of these slots in the garden array
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <sys/un.h>
+#include <netinet/tcp.h>
+
+#include "flower.h"
+#include "ringbuf.h"
+#include "timerwheel.h"
+#include "metrics.h"
+#include "asynclog.h"
+
+#define GARDEN_CHUNK      256    // flower slots per registry chunk
+#define GARDEN_MAX_CHUNKS 4096   // so about a million flowers before we say no
+
+#define GARDEN_MAX_TAGS       8     // tags one flower can declare in HELLO
+#define GARDEN_MAX_MEMBERSHIP 16    // groups (its own tags included) one flower can be in
+#define GARDEN_MAX_GROUPS     256   // tags and operator groups together
+#define GROUP_MAX_SELECTORS   8     // name / tag globs one GROUP can list
+
+#define MAX_REACTORS    16     // upper bound for -r
+#define REACTOR_EVENTS  256    // how many epoll events one reactor handles per wakeup
+#define CONN_IN_SIZE    1024   // per connection receive ring, a few status lines worth
+#define CONN_MAX_LINE   512    // longest line a flower may send, status lines are under 256
+#define OUT_QUEUE_DEFAULT 64   // commands that can wait for one flower before -o kicks in
+#define FLUSH_IOV       64     // most queued commands one writev will pick up
+
+#define STALE_DEFAULT_MS  5000    // quiet this long and a flower is marked stale (-s)
+#define EVICT_DEFAULT_MS  30000   // quiet this long and it is disconnected (-e)
+#define SWEEP_EVERY_MS    500     // how often the sweeper looks at every flower
+
+typedef struct Conn Conn;
+typedef struct Reactor Reactor;
+
+// each flower that connects gets one of these slots in the garden
 typedef struct {
     int  in_use;
     int  connfd;
+    Conn *conn;             // the socket this flower talks on, owned by its reactor
+    unsigned gen;           // bumped every time the slot is handed to a new flower
+    int  live_pos;          // where this slot sits in garden_live
     char name[32];
-    char last_status[256];  // most recent status line from that flower which updates often
+    int  num_tags;          // from tags=a,b,c in HELLO
+    char tags[GARDEN_MAX_TAGS][32];
+    int  num_groups;        // groups this flower is a member of
+    short group_id[GARDEN_MAX_MEMBERSHIP];
+    int  group_pos[GARDEN_MAX_MEMBERSHIP];   // where it sits in that groups member list
+    atomic_llong last_rx_ms;   // when its reactor last read anything from it (statuses, TIME, ...)
+    atomic_int   stale;        // the sweeper noticed it went quiet, cleared when it talks again
 } FlowerEntry;
 
-// this is my garden :) its fixed size list of possible flowers
-static FlowerEntry garden[MAX_FLOWERS];
-// mutex so multiple threads enter my garden at the same time
-static pthread_mutex_t garden_mutex = PTHREAD_MUTEX_INITIALIZER;
+// a named set of flowers, either a tag that flowers declared in HELLO or a GROUP the operator
+// made out of name / tag globs (or both, flowers tagged with a GROUPs name are always in it)
+// members are a dense slot list that is kept up to date as flowers come and go, so commanding
+// a group costs the size of the group and not the size of the garden
+typedef struct {
+    int      in_use;
+    uint32_t hash;
+    char     name[32];
+    int      num_selectors;          // 0 for a plain tag
+    char     selectors[GROUP_MAX_SELECTORS][32];
+    int     *members;                // slots
+    int      count;
+    int      cap;
+} Group;
+
+// what the last status said the flower was doing
+typedef enum {
+    FLOWER_STATE_NONE = 0,   // no status received yet
+    FLOWER_STATE_IDLE,
+    FLOWER_STATE_MOVING
+} FlowerState;
+
+// statuses are parsed once when they arrive and kept here as plain numbers,
+// one of these per registry chunk laid out structure of arrays style
+// slots that are free or have no status yet are all zeros
+//
+// every row has its own seqlock so the reactor that owns a flower can write its status
+// without taking any garden wide lock, readers retry if they raced with a write
+// everything that reads a row goes through status_load so it always sees one whole report
+typedef struct {
+    atomic_uint seq[GARDEN_CHUNK];                     // odd while a write is in progress
+    uint8_t state[GARDEN_CHUNK];                       // FlowerState
+    uint8_t num_petals[GARDEN_CHUNK];
+    uint8_t angle[FLOWER_MAX_PETALS][GARDEN_CHUNK];    // whole degrees, petal major
+    int64_t rx_ms[GARDEN_CHUNK];                       // CLOCK_MONOTONIC ms of the last update
+} StatusChunk;
+
+// the servers own copy of every flower that agreed to predict=1 in its HELLO
+// flower.c is deterministic so running the same commands through the same model here gives the
+// pose at any moment without the flower saying anything, the flower only sends a STATUS when it
+// notices its real pose drifted away from this (or as a heartbeat) and that re-anchors the copy
+// one lock per chunk, commands come from the console and timers, corrections from the reactors
+typedef struct {
+    pthread_mutex_t lock;
+    uint8_t predict[GARDEN_CHUNK];
+    Flower  f[GARDEN_CHUNK];
+    int64_t anchor_ms[GARDEN_CHUNK];     // time f[] describes
+} ShadowChunk;
+
+// open addressing bucket for the name index
+// slot is -1 for never used and -2 for a deleted bucket that lookups have to walk past
+typedef struct {
+    uint32_t hash;
+    int      slot;
+} NameBucket;
+
+#define NAME_EMPTY   (-1)
+#define NAME_DELETED (-2)
+
+// this is my garden :) slots live in fixed size chunks that never move once allocated,
+// so growing the garden is just adding another chunk
+static FlowerEntry *garden_chunks[GARDEN_MAX_CHUNKS];
+static StatusChunk *status_chunks[GARDEN_MAX_CHUNKS];   // same chunking as garden_chunks
+static ShadowChunk *shadow_chunks[GARDEN_MAX_CHUNKS];   // same again
+static int          garden_num_chunks = 0;
+
+// dense list of slots that are in use so walking the garden costs the number of flowers
+// and not the number of slots ever allocated
+static int *garden_live = NULL;
+static int  garden_count = 0;
+static int  garden_live_cap = 0;
+
+// stack of freed slots so they get reused before we allocate more chunks
+static int *garden_free = NULL;
+static int  garden_free_count = 0;
+static int  garden_free_cap = 0;
+
+// name -> slot, open addressing with linear probing
+static NameBucket *name_index = NULL;
+static size_t      name_index_cap = 0;
+static size_t      name_index_used = 0;   // live plus deleted buckets
+
+// connfd -> slot, file descriptors are small dense ints so a plain array does it
+static int *fd_index = NULL;
+static int  fd_index_cap = 0;
+
+// every tag and group, only ever touched with garden_lock held (for writing to change them)
+static Group groups[GARDEN_MAX_GROUPS];
+static int   group_high = 0;   // groups[] past this were never used
+
+// lock so multiple threads can enter my garden at the same time
+// only register and unregister take it for writing, LIST / STATUS / broadcasts share it
+// for reading, and status ingest does not touch it at all (see StatusChunk)
+static pthread_rwlock_t garden_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// one command line that can sit in any number of flower queues at once
+// OPEN all makes exactly one of these and every queue just holds a reference
+typedef struct {
+    atomic_int refs;
+    int        op;          // FLOWER_OP_* if this is a flower command, parsed once up front
+    FlowerCmd *args;        // the parsed arguments of SET / ANGLE / KEYS, NULL for the rest
+    int64_t    at_ms;       // start time on our clock from a trailing @t=, 0 for right away
+    size_t     len;
+    char       data[];
+} SharedMsg;
+
+// one of these per accepted socket, owned by whichever reactor accepted it
+// reads are non-blocking so partial lines just sit in the ring until the rest shows up
+// writes never happen on the callers thread, commands land in outq and the reactor drains it
+struct Conn {
+    int      fd;
+    Reactor *r;
+    int      said_hello;            // first complete line has to be HELLO
+    atomic_int slot;                // registry slot this conn reports into, -1 if none
+    int      proto_bin;             // flower asked for binary status frames
+    RingBuf  in;                    // everything received that has not been framed yet
+
+    pthread_mutex_t out_lock;       // guards outq, out_head, out_count and kill
+    SharedMsg **outq;               // ring of out_queue_limit messages
+    int      out_head;
+    int      out_count;
+    size_t   out_off;               // how much of the head message already went out (reactor only)
+    int      kill;                  // overflow policy wants this flower gone
+    int      want_out;              // EPOLLOUT is armed (reactor only)
+
+    int      flush_queued;          // on the reactors flush list (reactor lock)
+    int      closed;                // socket is gone, free it once it leaves the flush list
+    Conn    *flush_next;
+    Conn    *dead_next;             // graveyard link (reactor only)
+    TimerNode hello_timer;          // closes it if HELLO does not come in time (reactor only)
+};
+
+// a reactor is one thread with its own epoll set
+// every reactor also watches the listen socket so whichever one wakes up accepts
+// other threads hand it work by putting conns on the flush list and poking wakefd
+struct Reactor {
+    int       id;
+    int       epfd;
+    int       wakefd;
+    pthread_t tid;
+
+    pthread_mutex_t lock;           // guards flush_head and timer_inbox
+    Conn     *flush_head;
+
+    // commands scheduled for later, other threads drop them in the inbox and the
+    // reactor moves them into its own wheel which only it ever touches
+    TimerNode *timer_inbox;
+    TimerWheel timers;
+
+    // closed conns get freed at the end of an epoll batch, never in the middle,
+    // because later events in the same batch can still point at them
+    Conn     *graveyard;
+};
+
+// one command that should go out to one flower at a given time (BLOOM uses these)
+// slot and gen are checked again when it fires in case the flower left in the meantime
+typedef struct {
+    TimerNode  node;
+    Reactor   *r;        // reactor the flowers conn lived on when this was scheduled
+    int        slot;
+    unsigned   gen;
+    SharedMsg *msg;      // holds its own reference
+    int        shadow_only;   // the flower already has msg, only the prediction copy is due
+} ScheduledCmd;
+
+static Reactor reactors[MAX_REACTORS];
+static int     num_reactors = 1;
+static int     listenfd = -1;
+
+// what to do when a flower is so far behind that its queue is full
+typedef enum {
+    OVERFLOW_DROP,        // throw the new command away, the flower just misses it
+    OVERFLOW_DISCONNECT   // kick the flower, it can reconnect when it is healthy
+} OverflowPolicy;
+
+static int            out_queue_limit = OUT_QUEUE_DEFAULT;
+static OverflowPolicy overflow_policy = OVERFLOW_DROP;
+
+// liveness, 0 turns either one off
+static int stale_ms = STALE_DEFAULT_MS;
+static int evict_ms = EVICT_DEFAULT_MS;
+
+// QUIT sleeps on this until the last flower is gone, unregister_flower signals it
+static pthread_mutex_t garden_empty_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  garden_empty_cond = PTHREAD_COND_INITIALIZER;
+
+// every thread that counts something gets its own shard of these, so the reactors never share
+// a cache line over a counter and nothing on a hot path takes a lock to count
+// NETSTAT and the metrics endpoint add the shards up when somebody asks
+enum {
+    STAT_BROADCASTS,      // broadcast_command calls, group / glob sends and BLOOM runs
+    STAT_ENQUEUED,        // message references put into flower queues
+    STAT_DROPPED,         // commands thrown away because a queue was full
+    STAT_WAKEUPS,         // eventfd writes to poke a reactor
+    STAT_WRITEV_CALLS,    // writev syscalls made by the reactors
+    STAT_MSGS_WRITTEN,    // messages fully written to a socket
+    STAT_BYTES_WRITTEN,
+    STAT_MSGS_READ,       // lines and frames that came in from flowers
+    STAT_BYTES_READ,
+    STAT_STATUSES,        // of those, full statuses and deltas that updated a row
+    STAT_EVICTIONS,       // flowers the sweeper disconnected for being quiet too long
+    STAT_COUNT
+};
+
+typedef struct {
+    atomic_ulong counter[STAT_COUNT];
+    Histogram    status_ns;   // a complete status message until its row and prediction are updated
+    Histogram    fanout_ns;   // one console command until every queue has it and reactors are poked
+} __attribute__((aligned(64))) StatShard;
+
+// one per reactor, then the console, then everybody else shares the last one
+#define STAT_SHARD_CONSOLE MAX_REACTORS
+#define STAT_SHARD_OTHER   (MAX_REACTORS + 1)
+#define STAT_SHARDS        (MAX_REACTORS + 2)
+
+static StatShard stat_shards[STAT_SHARDS];
+static _Thread_local StatShard *my_shard = &stat_shards[STAT_SHARD_OTHER];
+
+static void stat_add(int which, unsigned long n) {
+    atomic_fetch_add_explicit(&my_shard->counter[which], n, memory_order_relaxed);
+}
+
+static unsigned long stat_total(int which) {
+    unsigned long sum = 0;
+    for (int i = 0; i < STAT_SHARDS; i++) {
+        sum += atomic_load_explicit(&stat_shards[i].counter[which], memory_order_relaxed);
+    }
+    return sum;
+}
+
+static int64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
 // basic helper to strip off newline
 static void trim_newline(char *s) {
@@ -34,260 +314,2095 @@ static void trim_newline(char *s) {
     }
 }
 
-// tiny wrapper around write so I dont need to repeat the error check every time
-static void sendLine(int fd, const char *line) {
-    ssize_t n = write(fd, line, strlen(line));
-    if (n < 0) {
-        printf("Warning: write() failed to fd %d\n", fd);
+// puts the conn on its reactors flush list unless it is already there
+// returns 1 if the reactor needs a poke afterwards
+static int schedule_flush(Conn *c) {
+    Reactor *r = c->r;
+    int was_empty = 0;
+    pthread_mutex_lock(&r->lock);
+    if (!c->flush_queued) {
+        was_empty = (r->flush_head == NULL);
+        c->flush_queued = 1;
+        c->flush_next = r->flush_head;
+        r->flush_head = c;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return was_empty;
+}
+
+// makes a new message holding one reference for the caller
+static SharedMsg *shared_msg_new(const char *line, size_t len) {
+    SharedMsg *m = malloc(sizeof(SharedMsg) + len);
+    if (m == NULL) return NULL;
+    atomic_init(&m->refs, 1);
+    // the flower gets the whole line, the parse here only needs the command in front of @t=
+    size_t cmd_len = len;
+    m->at_ms = 0;
+    Flower_splitStartTime(line, &cmd_len, &m->at_ms);
+    m->op = Flower_parseOpcode(line, cmd_len);
+    m->args = NULL;
+    if (FLOWER_OP_HAS_ARGS(m->op)) {
+        m->args = malloc(sizeof(FlowerCmd));
+        if (m->args == NULL || Flower_parseCommand(line, cmd_len, m->args) == FLOWER_OP_NONE) {
+            free(m->args);
+            m->args = NULL;
+            m->op = FLOWER_OP_NONE;
+        }
+    }
+    m->len = len;
+    memcpy(m->data, line, len);
+    return m;
+}
+
+// binary flowers get commands as 4 byte frames, there are only a handful of opcodes so
+// every frame is made once at startup and lives forever, each queue just takes a reference
+// the commands with arguments have no frame (NULL here) and go out as text to everybody
+static SharedMsg *cmd_frames[FLOWER_OP_COUNT];
+
+static void make_cmd_frames(void) {
+    for (int op = FLOWER_OP_NONE + 1; op < FLOWER_OP_COUNT; op++) {
+        unsigned char frame[FLOWER_FRAME_MAX];
+        size_t len = Flower_encodeCommand(op, frame, sizeof(frame));
+        if (len == 0) continue;
+        cmd_frames[op] = shared_msg_new((const char *)frame, len);
+        if (cmd_frames[op] == NULL) {
+            fprintf(stderr, "malloc failed for command frames\n");
+            exit(1);
+        }
+        cmd_frames[op]->op = op;
+    }
+}
+
+static void shared_msg_unref(SharedMsg *m) {
+    if (atomic_fetch_sub_explicit(&m->refs, 1, memory_order_acq_rel) == 1) {
+        free(m->args);
+        free(m);
+    }
+}
+
+// wakes up every reactor whose bit is set in mask
+// called after garden_lock is released so no syscall ever happens under it
+static void wake_reactors(uint32_t mask) {
+    for (int i = 0; i < num_reactors; i++) {
+        if (mask & (1u << i)) {
+            uint64_t one = 1;
+            ssize_t n = write(reactors[i].wakefd, &one, sizeof(one));
+            (void)n;   // only fails if the counter is already huge, the reactor wakes up anyway
+            stat_add(STAT_WAKEUPS, 1);
+        }
+    }
+}
+
+// queues one command for a flower, this is what replaced the old blocking write
+// the queue takes its own reference, no copy of the bytes is made
+// returns the bit of the reactor that needs waking (0 if none)
+// *queued (if given) says whether the message actually made it into the queue
+static uint32_t enqueue_msg(Conn *c, SharedMsg *m, const char *name, int *queued) {
+    if (queued != NULL) *queued = 0;
+    pthread_mutex_lock(&c->out_lock);
+    if (c->kill) {
+        // already on its way out, no point queueing more
+        pthread_mutex_unlock(&c->out_lock);
+        return 0;
+    }
+    if (c->out_count == out_queue_limit) {
+        if (overflow_policy == OVERFLOW_DISCONNECT) {
+            c->kill = 1;
+            pthread_mutex_unlock(&c->out_lock);
+            AsyncLog_log(LOG_LEVEL_WARN, "Queue full for flower '%s', disconnecting it\n", name);
+            return schedule_flush(c) ? (1u << c->r->id) : 0;
+        }
+        pthread_mutex_unlock(&c->out_lock);
+        stat_add(STAT_DROPPED, 1);
+        AsyncLog_log(LOG_LEVEL_WARN, "Queue full for flower '%s', dropping command\n", name);
+        return 0;
     }
+
+    atomic_fetch_add_explicit(&m->refs, 1, memory_order_relaxed);
+    int tail = (c->out_head + c->out_count) % out_queue_limit;
+    c->outq[tail] = m;
+    c->out_count++;
+    int first = (c->out_count == 1);
+    pthread_mutex_unlock(&c->out_lock);
+    stat_add(STAT_ENQUEUED, 1);
+    if (queued != NULL) *queued = 1;
+
+    // if something was already queued the reactor already knows about this conn
+    if (!first) return 0;
+    return schedule_flush(c) ? (1u << c->r->id) : 0;
+}
+
+// tells the reactor that owns c to close it, the same way a full queue does with -o disconnect
+// returns the bit of the reactor that needs waking, 0 if it was already on its way out
+static uint32_t kick_conn(Conn *c) {
+    pthread_mutex_lock(&c->out_lock);
+    int already = c->kill;
+    c->kill = 1;
+    pthread_mutex_unlock(&c->out_lock);
+    if (already) return 0;
+    return schedule_flush(c) ? (1u << c->r->id) : 0;
 }
 
 // just displays all the commands in case needed
 // i made this also display if an invalid command is enteed
 static void print_help(void) {
-    printf("Commands:\n");
+    printf("Commands (<name> can also be a tag, a group or a glob like rose*):\n");
+    printf("Flower commands can end in @+<ms> or @t=<server_ms> to start everywhere at once\n");
     printf("  OPEN all|<name>        Open all flowers or one flower\n");
     printf("  CLOSE all|<name>       Close all flowers or one flower\n");
     printf("  SEQ1 all|<name>        Petal sequence 1 (left-to-right)\n");
     printf("  SEQ2 all|<name>        Petal sequence 2 (outside-in)\n");
     printf("  TERMINATE all|<name>   Close and terminate clients\n");
+    printf("  SET all|<name> [speed=<deg/s>] [bloom=<deg>] [close=<deg>] [gap=<ms>]\n");
+    printf("                         Change how a flower moves\n");
+    printf("  ANGLE all|<name> [i=<petal>] deg=<deg>\n");
+    printf("                         Send one petal (or all of them) to an angle\n");
+    printf("  KEYS all|<name> [every=<ms> [times=<n>]] <at_ms>:<deg>[,<deg>...] ...\n");
+    printf("                         Upload a keyframe table the flowers play on their own\n");
+    printf("  GROUP <group> <pattern> [<pattern>...]\n");
+    printf("                         Group the flowers whose name or tag matches a pattern\n");
+    printf("  UNGROUP <group>        Forget a group (flowers tagged with it stay in it)\n");
+    printf("  GROUPS                 List tags and groups with their sizes\n");
     printf("  BLOOM                  Random sequence per flower, staggered\n");
+    printf("  CLOCK                  Show the server clock that @t= start times use\n");
     printf("  LIST                   List connected flowers\n");
     printf("  STATUS                 Show most recent STATUS per flower\n");
+    printf("  COUNT [state]          How many flowers are MOVING, IDLE or NONE (no status)\n");
+    printf("  MEAN [petal]           Mean petal angle across the garden\n");
+    printf("  NETSTAT                Show broadcast fan-out and syscall counters\n");
+    printf("  METRICS                Print everything the -m metrics socket serves\n");
+    printf("  LOGLEVEL <level>       Only log error, warn, info (default) or debug and up\n");
     printf("  HELP                   Show this help text\n");
     printf("  QUIT                   CLOSE all, TERMINATE all, and exit\n");
 }
 
-// when a client sends HELLO name=blahblahblah that data gets stored
-static void register_flower(int connfd, const char *name) {
-    pthread_mutex_lock(&garden_mutex);
+// slot number -> entry, chunks are allocated in slot order so this is just two array lookups
+static FlowerEntry *garden_slot(int slot) {
+    return &garden_chunks[slot / GARDEN_CHUNK][slot % GARDEN_CHUNK];
+}
 
-    // if we already have this name just refresh its fd / status
-    for (int i = 0; i < MAX_FLOWERS; i++) {
-        if (garden[i].in_use && strcmp(garden[i].name, name) == 0) {
-            garden[i].connfd = connfd;
-            garden[i].last_status[0] = '\0';
-            pthread_mutex_unlock(&garden_mutex);
-            printf("Updated flower '%s' (fd=%d)\n", name, connfd);
-            return;
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// seqlock writer side, the compare and swap also keeps two writers off the same row
+// (an old and a new connection for the same name can both be reporting for a moment)
+static void status_write_begin(StatusChunk *sc, int i) {
+    unsigned s = atomic_load_explicit(&sc->seq[i], memory_order_relaxed);
+    while (1) {
+        if ((s & 1) == 0 &&
+            atomic_compare_exchange_weak_explicit(&sc->seq[i], &s, s + 1,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+        s = atomic_load_explicit(&sc->seq[i], memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release);
+}
+
+static void status_write_end(StatusChunk *sc, int i) {
+    atomic_fetch_add_explicit(&sc->seq[i], 1, memory_order_release);
+}
+
+// the status store helpers below do not need garden_lock, the row seqlock covers them
+
+static void status_clear(int slot) {
+    StatusChunk *sc = status_chunks[slot / GARDEN_CHUNK];
+    int i = slot % GARDEN_CHUNK;
+    status_write_begin(sc, i);
+    sc->state[i] = FLOWER_STATE_NONE;
+    sc->num_petals[i] = 0;
+    for (int p = 0; p < FLOWER_MAX_PETALS; p++) sc->angle[p][i] = 0;
+    sc->rx_ms[i] = 0;
+    status_write_end(sc, i);
+}
+
+static void status_store(int slot, const FlowerStatusFrame *fr, int64_t rx_ms) {
+    StatusChunk *sc = status_chunks[slot / GARDEN_CHUNK];
+    int i = slot % GARDEN_CHUNK;
+    status_write_begin(sc, i);
+    sc->state[i] = fr->moving ? FLOWER_STATE_MOVING : FLOWER_STATE_IDLE;
+    sc->num_petals[i] = (uint8_t)fr->num_petals;
+    // petals past num_petals stay zero so the fleet loops can add them blindly
+    for (int p = 0; p < FLOWER_MAX_PETALS; p++) {
+        sc->angle[p][i] = (p < fr->num_petals) ? fr->angles[p] : 0;
+    }
+    sc->rx_ms[i] = rx_ms;
+    status_write_end(sc, i);
+}
+
+// pulls one flowers row back out as a frame, num_petals is 0 if it never reported
+// seqlock reader side, never blocks the writer and just tries again if it lost the race
+static void status_load(int slot, FlowerStatusFrame *fr, int64_t *rx_ms) {
+    StatusChunk *sc = status_chunks[slot / GARDEN_CHUNK];
+    int i = slot % GARDEN_CHUNK;
+    int64_t rx;
+    unsigned s1, s2;
+
+    do {
+        s1 = atomic_load_explicit(&sc->seq[i], memory_order_acquire);
+        if (s1 & 1) continue;
+
+        memset(fr, 0, sizeof(*fr));
+        fr->id = (uint32_t)slot;
+        fr->moving = (sc->state[i] == FLOWER_STATE_MOVING);
+        fr->num_petals = sc->num_petals[i];
+        if (fr->num_petals > FLOWER_MAX_PETALS) fr->num_petals = FLOWER_MAX_PETALS;
+        for (int p = 0; p < fr->num_petals; p++) {
+            fr->angles[p] = sc->angle[p][i];
+        }
+        rx = sc->rx_ms[i];
+
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(&sc->seq[i], memory_order_relaxed);
+        if (s1 == s2) break;
+    } while (1);
+
+    if (rx_ms != NULL) *rx_ms = rx;
+}
+
+// FNV-1a, plenty for flower names
+static uint32_t hash_name(const char *name) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// grows an int array to hold at least need elements, new elements are set to fill
+// returns 0 if we ran out of memory
+static int grow_int_array(int **arr, int *cap, int need, int fill) {
+    if (need <= *cap) return 1;
+    int new_cap = (*cap > 0) ? *cap : 64;
+    while (new_cap < need) new_cap *= 2;
+    int *p = realloc(*arr, (size_t)new_cap * sizeof(int));
+    if (p == NULL) return 0;
+    for (int i = *cap; i < new_cap; i++) p[i] = fill;
+    *arr = p;
+    *cap = new_cap;
+    return 1;
+}
+
+static ShadowChunk *shadow_of(int slot, int *i) {
+    *i = slot % GARDEN_CHUNK;
+    return shadow_chunks[slot / GARDEN_CHUNK];
+}
+
+// new flower (or a reconnect) in this slot, starts out closed like flower_client does
+// also called with predict 0 when the slot is freed so the next flower never inherits the flag
+static void shadow_reset(int slot, const char *name, int num_petals, int predict) {
+    int i;
+    ShadowChunk *hc = shadow_of(slot, &i);
+    pthread_mutex_lock(&hc->lock);
+    Flower_init(&hc->f[i], name, num_petals);
+    hc->anchor_ms[i] = now_ms();
+    hc->predict[i] = (uint8_t)predict;
+    pthread_mutex_unlock(&hc->lock);
+}
+
+// 1 if the flower in this slot asked for predict=1, read under the chunk lock like every
+// other access to the copy
+static int shadow_predicting(int slot) {
+    int i;
+    ShadowChunk *hc = shadow_of(slot, &i);
+    pthread_mutex_lock(&hc->lock);
+    int predict = hc->predict[i];
+    pthread_mutex_unlock(&hc->lock);
+    return predict;
+}
+
+// a command just got queued for this flower (or its start time came), run it through the copy too
+// the flower applies it a network hop later, that gap is far below the correction threshold
+static void shadow_command(int slot, const SharedMsg *m) {
+    int i;
+    ShadowChunk *hc = shadow_of(slot, &i);
+
+    pthread_mutex_lock(&hc->lock);
+    if (hc->predict[i]) {
+        // a timed command lands exactly on its start time even if the timer ran a bit late
+        int64_t now = now_ms();
+        if (m->at_ms > hc->anchor_ms[i] && m->at_ms < now) now = m->at_ms;
+        Flower_advance(&hc->f[i], (int)(now - hc->anchor_ms[i]));
+        hc->anchor_ms[i] = now;
+        // TERMINATE closes the petals too
+        if (m->args != NULL) Flower_applyCmd(&hc->f[i], m->args);
+        else Flower_applyOpcode(&hc->f[i], m->op);
+    }
+    pthread_mutex_unlock(&hc->lock);
+}
+
+// the flower told us where it really is, move the copy there and keep predicting from it
+static void shadow_correct(int slot, const FlowerStatusFrame *fr, int64_t rx_ms) {
+    int i;
+    ShadowChunk *hc = shadow_of(slot, &i);
+    pthread_mutex_lock(&hc->lock);
+    if (hc->predict[i]) {
+        Flower *f = &hc->f[i];
+        Flower_advance(f, (int)(rx_ms - hc->anchor_ms[i]));
+        hc->anchor_ms[i] = rx_ms;
+        for (int p = 0; p < f->num_petals && p < fr->num_petals; p++) {
+            f->petals[p].current_angle = (float)fr->angles[p];
+        }
+    }
+    pthread_mutex_unlock(&hc->lock);
+}
+
+// where the copy says the flower is right now, returns 0 if this flower does not predict
+static int shadow_predict(int slot, int64_t now, FlowerStatusFrame *fr) {
+    int i;
+    ShadowChunk *hc = shadow_of(slot, &i);
+    pthread_mutex_lock(&hc->lock);
+    int predict = hc->predict[i];
+    if (predict) {
+        Flower f = hc->f[i];
+        Flower_advance(&f, (int)(now - hc->anchor_ms[i]));
+        memset(fr, 0, sizeof(*fr));
+        fr->id = (uint32_t)slot;
+        fr->moving = Flower_isMoving(&f);
+        fr->num_petals = f.num_petals;
+        for (int p = 0; p < f.num_petals; p++) {
+            int a = (int)(f.petals[p].current_angle + 0.5f);
+            fr->angles[p] = (uint8_t)(a < 0 ? 0 : (a > 255 ? 255 : a));
+        }
+    }
+    pthread_mutex_unlock(&hc->lock);
+    return predict;
+}
+
+// one flowers status as the console should show it, the row as it came in or for a predicting
+// flower where its copy says it is right now, rx is still the time of the last real report
+// the rows only ever hold what the flowers sent, DELTA lines and frames patch onto those
+// returns 1 if fr is a prediction
+static int status_view(int slot, int64_t now, FlowerStatusFrame *fr, int64_t *rx_ms) {
+    status_load(slot, fr, rx_ms);
+    if (fr->num_petals == 0) return 0;   // still waiting for its first status
+    return shadow_predict(slot, now, fr);
+}
+
+// status that came in from a flower, the row gets it and so does the prediction copy
+// t0 is when its handler started on it, the whole parse and store goes into status_ns
+static void ingest_status(int slot, const FlowerStatusFrame *fr, int64_t t0) {
+    int64_t rx = now_ms();
+    status_store(slot, fr, rx);
+    shadow_correct(slot, fr, rx);
+    stat_add(STAT_STATUSES, 1);
+    Histogram_record(&my_shard->status_ns, (uint64_t)(mono_ns() - t0));
+}
+
+static uint32_t schedule_shadow(int slot, FlowerEntry *e, SharedMsg *m);
+
+// queues a console / timer command for the flower in slot and keeps its prediction in step
+// a flower on proto=bin gets the command frame for the same opcode instead of the text,
+// unless the command has a start time, frames have no room for that
+// expects garden_lock to be held, returns the bit of the reactor that needs waking
+static uint32_t command_flower(int slot, FlowerEntry *e, SharedMsg *m) {
+    int queued;
+    if (e->conn->proto_bin && m->at_ms == 0 && cmd_frames[m->op] != NULL) {
+        m = cmd_frames[m->op];
+    }
+    uint32_t wake = enqueue_msg(e->conn, m, e->name, &queued);
+    if (queued) {
+        // the flower holds a timed command until its start time, so the copy waits too
+        if (m->at_ms > now_ms()) wake |= schedule_shadow(slot, e, m);
+        else shadow_command(slot, m);
+    }
+    return wake;
+}
+
+// all of the index helpers below expect garden_lock to be held for writing
+
+static int name_index_find(const char *name, uint32_t h) {
+    if (name_index_cap == 0) return -1;
+    size_t mask = name_index_cap - 1;
+    for (size_t i = h & mask; ; i = (i + 1) & mask) {
+        NameBucket *b = &name_index[i];
+        if (b->slot == NAME_EMPTY) return -1;
+        if (b->slot >= 0 && b->hash == h && strcmp(garden_slot(b->slot)->name, name) == 0) {
+            return b->slot;
         }
     }
+}
+
+static void name_index_put_raw(uint32_t h, int slot) {
+    size_t mask = name_index_cap - 1;
+    size_t i = h & mask;
+    while (name_index[i].slot >= 0) i = (i + 1) & mask;
+    if (name_index[i].slot == NAME_EMPTY) name_index_used++;
+    name_index[i].hash = h;
+    name_index[i].slot = slot;
+}
+
+// rebuilds the table at a new size which also throws away all the deleted buckets
+static int name_index_resize(size_t new_cap) {
+    NameBucket *old = name_index;
+    size_t old_cap = name_index_cap;
+
+    NameBucket *fresh = malloc(new_cap * sizeof(NameBucket));
+    if (fresh == NULL) return 0;
+    for (size_t i = 0; i < new_cap; i++) fresh[i].slot = NAME_EMPTY;
+
+    name_index = fresh;
+    name_index_cap = new_cap;
+    name_index_used = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].slot >= 0) name_index_put_raw(old[i].hash, old[i].slot);
+    }
+    free(old);
+    return 1;
+}
+
+static int name_index_insert(uint32_t h, int slot) {
+    // keep the load (deleted buckets included) under 70% so probes stay short
+    if ((name_index_used + 1) * 10 >= name_index_cap * 7) {
+        size_t new_cap = (name_index_cap == 0) ? 256 : name_index_cap;
+        if ((size_t)garden_count * 2 * 10 >= new_cap * 7) new_cap *= 2;
+        if (!name_index_resize(new_cap)) return 0;
+    }
+    name_index_put_raw(h, slot);
+    return 1;
+}
 
-    // otherwise find an empty slot and claim it
-    for (int i = 0; i < MAX_FLOWERS; i++) {
-        if (!garden[i].in_use) {
-            garden[i].in_use = 1;
-            garden[i].connfd = connfd;
-            strncpy(garden[i].name, name, sizeof(garden[i].name) - 1);
-            garden[i].name[sizeof(garden[i].name) - 1] = '\0';
-            garden[i].last_status[0] = '\0';
-            pthread_mutex_unlock(&garden_mutex);
-            printf("Registered flower '%s' (fd=%d)\n", name, connfd);
+static void name_index_remove(uint32_t h, int slot) {
+    size_t mask = name_index_cap - 1;
+    for (size_t i = h & mask; name_index[i].slot != NAME_EMPTY; i = (i + 1) & mask) {
+        if (name_index[i].slot == slot) {
+            name_index[i].slot = NAME_DELETED;
             return;
         }
     }
+}
 
-    // if we are here the garden is full
-    pthread_mutex_unlock(&garden_mutex);
-    printf("No space left in garden for flower '%s'\n", name);
+static int fd_index_get(int fd) {
+    if (fd < 0 || fd >= fd_index_cap) return -1;
+    return fd_index[fd];
 }
 
-// when a client disconnects this clears out that spot in the garden
-static void unregister_flower(int connfd) {
-    pthread_mutex_lock(&garden_mutex);
-    for (int i = 0; i < MAX_FLOWERS; i++) {
-        if (garden[i].in_use && garden[i].connfd == connfd) {
-            printf("Removing flower '%s' (fd=%d)\n", garden[i].name, connfd);
-            garden[i].in_use = 0;
+static int fd_index_set(int fd, int slot) {
+    if (!grow_int_array(&fd_index, &fd_index_cap, fd + 1, -1)) return 0;
+    fd_index[fd] = slot;
+    return 1;
+}
+
+// groups are looked up by name in a small table, the garden has a handful of beds and rows
+// and not millions of them so a linear probe over GARDEN_MAX_GROUPS names is plenty
+static int group_find(const char *name) {
+    uint32_t h = hash_name(name);
+    for (int i = 0; i < group_high; i++) {
+        if (groups[i].in_use && groups[i].hash == h && strcmp(groups[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+static int group_create(const char *name) {
+    int id = -1;
+    for (int i = 0; i < group_high; i++) {
+        if (!groups[i].in_use) {
+            id = i;
             break;
         }
     }
-    pthread_mutex_unlock(&garden_mutex);
+    if (id < 0) {
+        if (group_high == GARDEN_MAX_GROUPS) return -1;
+        id = group_high++;
+    }
+    Group *g = &groups[id];
+    g->in_use = 1;
+    strncpy(g->name, name, sizeof(g->name) - 1);
+    g->name[sizeof(g->name) - 1] = '\0';
+    g->hash = hash_name(g->name);
+    g->num_selectors = 0;
+    g->count = 0;
+    return id;
+}
+
+static int flower_has_tag(const FlowerEntry *e, const char *tag) {
+    for (int t = 0; t < e->num_tags; t++) {
+        if (strcmp(e->tags[t], tag) == 0) return 1;
+    }
+    return 0;
+}
+
+// a glob matches a flower if it matches its name or any of its tags
+static int flower_matches_glob(const FlowerEntry *e, const char *pattern) {
+    if (fnmatch(pattern, e->name, 0) == 0) return 1;
+    for (int t = 0; t < e->num_tags; t++) {
+        if (fnmatch(pattern, e->tags[t], 0) == 0) return 1;
+    }
+    return 0;
+}
+
+// flowers tagged with the groups name are always in it, GROUP selectors can pull in more
+static int group_wants(const Group *g, const FlowerEntry *e) {
+    if (flower_has_tag(e, g->name)) return 1;
+    for (int s = 0; s < g->num_selectors; s++) {
+        if (flower_matches_glob(e, g->selectors[s])) return 1;
+    }
+    return 0;
+}
+
+static int group_add(int id, int slot) {
+    Group *g = &groups[id];
+    FlowerEntry *e = garden_slot(slot);
+    for (int k = 0; k < e->num_groups; k++) {
+        if (e->group_id[k] == id) return 1;
+    }
+    if (e->num_groups == GARDEN_MAX_MEMBERSHIP) return 0;
+    if (!grow_int_array(&g->members, &g->cap, g->count + 1, -1)) return 0;
+
+    e->group_id[e->num_groups] = (short)id;
+    e->group_pos[e->num_groups] = g->count;
+    e->num_groups++;
+    g->members[g->count++] = slot;
+    return 1;
+}
+
+// same swap with the last trick as garden_live, the flower remembers where it sits in
+// every group so leaving costs the number of groups it is in
+static void group_remove(int id, int slot) {
+    Group *g = &groups[id];
+    FlowerEntry *e = garden_slot(slot);
+    for (int k = 0; k < e->num_groups; k++) {
+        if (e->group_id[k] != id) continue;
+
+        int pos = e->group_pos[k];
+        int last = g->members[--g->count];
+        g->members[pos] = last;
+        FlowerEntry *le = garden_slot(last);
+        for (int j = 0; j < le->num_groups; j++) {
+            if (le->group_id[j] == id) le->group_pos[j] = pos;
+        }
+
+        e->num_groups--;
+        e->group_id[k] = e->group_id[e->num_groups];
+        e->group_pos[k] = e->group_pos[e->num_groups];
+        return;
+    }
+}
+
+// a group nobody is in and nobody defined is just a tag that went away
+static void group_drop_if_unused(int id) {
+    Group *g = &groups[id];
+    if (g->count == 0 && g->num_selectors == 0) g->in_use = 0;
+}
+
+// runs when a flower registers, every tag it declared becomes a group if it is not one yet
+// and every operator group whose selectors match picks it up
+static void flower_join_groups(int slot) {
+    FlowerEntry *e = garden_slot(slot);
+    for (int t = 0; t < e->num_tags; t++) {
+        if (group_find(e->tags[t]) < 0 && group_create(e->tags[t]) < 0) {
+            AsyncLog_log(LOG_LEVEL_WARN, "Too many groups, tag '%s' of '%s' is ignored\n",
+                         e->tags[t], e->name);
+        }
+    }
+    for (int id = 0; id < group_high; id++) {
+        if (groups[id].in_use && group_wants(&groups[id], e) && !group_add(id, slot)) {
+            AsyncLog_log(LOG_LEVEL_WARN, "Flower '%s' is in too many groups, left out of '%s'\n",
+                         e->name, groups[id].name);
+        }
+    }
+}
+
+static void flower_leave_groups(int slot) {
+    FlowerEntry *e = garden_slot(slot);
+    while (e->num_groups > 0) {
+        int id = e->group_id[0];
+        group_remove(id, slot);
+        group_drop_if_unused(id);
+    }
+}
+
+// throws away a groups members and collects them again from the whole garden
+// only GROUP / UNGROUP do this, registering and leaving keep the lists up to date one flower at a time
+static void group_rebuild(int id) {
+    Group *g = &groups[id];
+    while (g->count > 0) group_remove(id, g->members[g->count - 1]);
+    for (int i = 0; i < garden_count; i++) {
+        int slot = garden_live[i];
+        if (group_wants(g, garden_slot(slot))) group_add(id, slot);
+    }
+}
+
+// splits tags=a,b,c from HELLO into the entry, empty and repeated tags are skipped
+static void set_flower_tags(FlowerEntry *e, const char *list) {
+    e->num_tags = 0;
+    while (*list != '\0' && e->num_tags < GARDEN_MAX_TAGS) {
+        size_t n = strcspn(list, ",");
+        if (n > 0 && n < sizeof(e->tags[0])) {
+            char *tag = e->tags[e->num_tags];
+            memcpy(tag, list, n);
+            tag[n] = '\0';
+            if (!flower_has_tag(e, tag)) {
+                // flower_has_tag only looks at the tags before this one
+                e->num_tags++;
+            }
+        }
+        list += n;
+        if (*list == ',') list++;
+    }
+}
+
+// hands out a free slot, reusing old ones first and adding a chunk when we run dry
+static int garden_alloc_slot(void) {
+    if (garden_free_count > 0) {
+        return garden_free[--garden_free_count];
+    }
+    if (garden_num_chunks == GARDEN_MAX_CHUNKS) return -1;
+
+    // reserve room in the free stack and the live list for every slot in the new chunk
+    // up front, that way releasing a slot or marking it live can never fail later
+    int total = (garden_num_chunks + 1) * GARDEN_CHUNK;
+    if (!grow_int_array(&garden_free, &garden_free_cap, total, -1) ||
+        !grow_int_array(&garden_live, &garden_live_cap, total, -1)) {
+        return -1;
+    }
+
+    FlowerEntry *chunk = calloc(GARDEN_CHUNK, sizeof(FlowerEntry));
+    StatusChunk *schunk = calloc(1, sizeof(StatusChunk));
+    ShadowChunk *hchunk = calloc(1, sizeof(ShadowChunk));
+    if (chunk == NULL || schunk == NULL || hchunk == NULL) {
+        free(chunk);
+        free(schunk);
+        free(hchunk);
+        return -1;
+    }
+    pthread_mutex_init(&hchunk->lock, NULL);
+
+    int base = garden_num_chunks * GARDEN_CHUNK;
+    status_chunks[garden_num_chunks] = schunk;
+    shadow_chunks[garden_num_chunks] = hchunk;
+    garden_chunks[garden_num_chunks++] = chunk;
+
+    // push the new slots so the lowest one comes out first
+    for (int i = GARDEN_CHUNK - 1; i >= 1; i--) {
+        garden_free[garden_free_count++] = base + i;
+    }
+    return base;
+}
+
+static void garden_release_slot(int slot) {
+    garden_free[garden_free_count++] = slot;
+}
+
+// when a client sends HELLO name=blahblahblah that data gets stored
+// tags is the comma separated list from tags= (empty if there was none)
+// the prediction copy is reset under the write lock too, so nobody walking the garden ever
+// sees the new flower next to the copy (or predict flag) of whoever had the slot before
+// returns the slot the flower landed in or -1 if it could not be registered
+static int register_flower(Conn *c, const char *name, const char *tags, int num_petals, int predict) {
+    int connfd = c->fd;
+    uint32_t h = hash_name(name);
+
+    pthread_rwlock_wrlock(&garden_lock);
+
+    // if we already have this name just refresh its fd / status
+    int slot = name_index_find(name, h);
+    if (slot >= 0) {
+        FlowerEntry *e = garden_slot(slot);
+        if (fd_index_get(e->connfd) == slot) fd_index_set(e->connfd, -1);
+        if (!fd_index_set(connfd, slot)) {
+            pthread_rwlock_unlock(&garden_lock);
+            AsyncLog_log(LOG_LEVEL_ERROR, "Out of memory updating flower '%s'\n", name);
+            return -1;
+        }
+        // the old connection stops reporting into this slot, and since the flower came back on
+        // a new one the old socket is dead or half open, it gets closed instead of lingering
+        uint32_t wake = 0;
+        if (e->conn != NULL && e->conn != c) {
+            atomic_store(&e->conn->slot, -1);
+            wake = kick_conn(e->conn);
+        }
+        e->connfd = connfd;
+        e->conn = c;
+        atomic_store(&c->slot, slot);
+        atomic_store(&e->last_rx_ms, now_ms());
+        atomic_store(&e->stale, 0);
+        status_clear(slot);
+        shadow_reset(slot, name, num_petals, predict);
+        // it may have come back with different tags
+        flower_leave_groups(slot);
+        set_flower_tags(e, tags);
+        flower_join_groups(slot);
+        pthread_rwlock_unlock(&garden_lock);
+        wake_reactors(wake);
+        AsyncLog_log(LOG_LEVEL_INFO, "Updated flower '%s' (fd=%d)\n", name, connfd);
+        return slot;
+    }
+
+    // otherwise grab a slot and hook it into both indexes
+    slot = garden_alloc_slot();
+    if (slot < 0) {
+        // if we are here the garden is full
+        pthread_rwlock_unlock(&garden_lock);
+        AsyncLog_log(LOG_LEVEL_WARN, "No space left in garden for flower '%s'\n", name);
+        return -1;
+    }
+
+    FlowerEntry *e = garden_slot(slot);
+    strncpy(e->name, name, sizeof(e->name) - 1);
+    e->name[sizeof(e->name) - 1] = '\0';
+
+    if (!fd_index_set(connfd, slot) ||
+        !name_index_insert(hash_name(e->name), slot)) {
+        fd_index_set(connfd, -1);
+        garden_release_slot(slot);
+        pthread_rwlock_unlock(&garden_lock);
+        AsyncLog_log(LOG_LEVEL_ERROR, "Out of memory registering flower '%s'\n", name);
+        return -1;
+    }
+
+    e->in_use = 1;
+    e->connfd = connfd;
+    e->conn = c;
+    e->gen++;
+    status_clear(slot);
+    shadow_reset(slot, name, num_petals, predict);
+    atomic_store(&e->last_rx_ms, now_ms());
+    atomic_store(&e->stale, 0);
+    atomic_store(&c->slot, slot);
+    e->live_pos = garden_count;
+    garden_live[garden_count++] = slot;
+    set_flower_tags(e, tags);
+    flower_join_groups(slot);
+
+    pthread_rwlock_unlock(&garden_lock);
+    AsyncLog_log(LOG_LEVEL_INFO, "Registered flower '%s' (fd=%d)\n", name, connfd);
+    return slot;
+}
+
+// when a client disconnects this clears out that spot in the garden
+static void unregister_flower(int connfd) {
+    pthread_rwlock_wrlock(&garden_lock);
+    int slot = fd_index_get(connfd);
+    if (slot >= 0) {
+        FlowerEntry *e = garden_slot(slot);
+        AsyncLog_log(LOG_LEVEL_INFO, "Removing flower '%s' (fd=%d)\n", e->name, connfd);
+
+        name_index_remove(hash_name(e->name), slot);
+        fd_index_set(connfd, -1);
+        flower_leave_groups(slot);
+
+        // swap the last live slot into this ones spot so the list stays dense
+        int last = garden_live[--garden_count];
+        garden_live[e->live_pos] = last;
+        garden_slot(last)->live_pos = e->live_pos;
+
+        e->in_use = 0;
+        if (e->conn != NULL) atomic_store(&e->conn->slot, -1);
+        e->conn = NULL;
+        status_clear(slot);
+        shadow_reset(slot, "", 0, 0);
+        garden_release_slot(slot);
+    }
+    int empty = (garden_count == 0);
+    pthread_rwlock_unlock(&garden_lock);
+
+    if (empty) {
+        pthread_mutex_lock(&garden_empty_lock);
+        pthread_cond_broadcast(&garden_empty_cond);
+        pthread_mutex_unlock(&garden_empty_lock);
+    }
 }
 
 // send the same command line to every flower connected
+// this only queues one shared copy, the reactors do the actual writes once they get poked
 static void broadcast_command(const char *cmd) {
-    pthread_mutex_lock(&garden_mutex);
-    for (int i = 0; i < MAX_FLOWERS; i++) {
-        if (garden[i].in_use) {
-            sendLine(garden[i].connfd, cmd);
+    int64_t t0 = mono_ns();
+    SharedMsg *m = shared_msg_new(cmd, strlen(cmd));
+    if (m == NULL) {
+        printf("malloc failed for broadcast\n");
+        return;
+    }
+    uint32_t wake = 0;
+
+    pthread_rwlock_rdlock(&garden_lock);
+    for (int i = 0; i < garden_count; i++) {
+        FlowerEntry *e = garden_slot(garden_live[i]);
+        wake |= command_flower(garden_live[i], e, m);
+    }
+    pthread_rwlock_unlock(&garden_lock);
+
+    wake_reactors(wake);
+    shared_msg_unref(m);
+    stat_add(STAT_BROADCASTS, 1);
+    Histogram_record(&my_shard->fanout_ns, (uint64_t)(mono_ns() - t0));
+}
+
+// send a command line to whatever a console target other than all picks out, in this order
+//   <name>    the flower with that name
+//   <group>   every member of that tag or GROUP
+//   <glob>    every flower whose name or one of its tags matches, like rose* or row[1-3]
+// same single shared copy as broadcast_command, only the list of slots it walks is different
+static void send_to_target(const char *target, const char *cmd) {
+    int64_t t0 = mono_ns();
+    SharedMsg *m = shared_msg_new(cmd, strlen(cmd));
+    if (m == NULL) {
+        printf("malloc failed for %s\n", target);
+        return;
+    }
+    uint32_t wake = 0;
+    int sent = 0;
+    int id = -1;
+
+    pthread_rwlock_rdlock(&garden_lock);
+    int slot = name_index_find(target, hash_name(target));
+    if (slot >= 0) {
+        wake = command_flower(slot, garden_slot(slot), m);
+        sent = 1;
+    } else if ((id = group_find(target)) >= 0) {
+        Group *g = &groups[id];
+        for (int i = 0; i < g->count; i++) {
+            int s = g->members[i];
+            wake |= command_flower(s, garden_slot(s), m);
         }
+        sent = g->count;
+    } else if (strpbrk(target, "*?[") != NULL) {
+        for (int i = 0; i < garden_count; i++) {
+            FlowerEntry *e = garden_slot(garden_live[i]);
+            if (flower_matches_glob(e, target)) {
+                wake |= command_flower(garden_live[i], e, m);
+                sent++;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&garden_lock);
+
+    wake_reactors(wake);
+    shared_msg_unref(m);
+    if (slot < 0 && sent > 0) {
+        stat_add(STAT_BROADCASTS, 1);
+        Histogram_record(&my_shard->fanout_ns, (uint64_t)(mono_ns() - t0));
+    }
+
+    if (id >= 0 && sent == 0) {
+        printf("Group '%s' has no flowers right now.\n", target);
+    } else if (sent == 0) {
+        printf("No flower or group matches '%s'.\n", target);
     }
-    pthread_mutex_unlock(&garden_mutex);
 }
 
-// send a command line to just one flower by name
-static void send_to_one(const char *name, const char *cmd) {
-    int found = 0;
-    pthread_mutex_lock(&garden_mutex);
-    for (int i = 0; i < MAX_FLOWERS; i++) {
-        if (garden[i].in_use && strcmp(garden[i].name, name) == 0) {
-            sendLine(garden[i].connfd, cmd);
-            found = 1;
-            break;
+// GROUP <name> <glob> [<glob> ...] makes (or redefines) a group out of name / tag globs
+// the members are worked out once here and then kept up to date as flowers register and leave
+static void define_group(const char *name, const char *rest) {
+    char buf[FLOWER_CMD_MAX];
+    strncpy(buf, rest, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    char selectors[GROUP_MAX_SELECTORS][32];
+    int n = 0;
+    for (char *tok = strtok(buf, " \t"); tok != NULL; tok = strtok(NULL, " \t")) {
+        if (n == GROUP_MAX_SELECTORS || strlen(tok) >= sizeof(selectors[0])) {
+            printf("GROUP takes up to %d patterns of up to %d characters\n",
+                   GROUP_MAX_SELECTORS, (int)sizeof(selectors[0]) - 1);
+            return;
         }
+        strcpy(selectors[n++], tok);
     }
-    pthread_mutex_unlock(&garden_mutex);
-    if (!found) {
-        printf("No flower named '%s' is connected.\n", name);
+    if (n == 0) {
+        printf("GROUP %s needs at least one name or tag pattern\n", name);
+        return;
+    }
+
+    pthread_rwlock_wrlock(&garden_lock);
+    if (name_index_find(name, hash_name(name)) >= 0) {
+        // the flower would win every lookup and the group could never be commanded
+        pthread_rwlock_unlock(&garden_lock);
+        printf("'%s' is already a flower name\n", name);
+        return;
+    }
+    int id = group_find(name);
+    if (id < 0) id = group_create(name);
+    if (id < 0) {
+        pthread_rwlock_unlock(&garden_lock);
+        printf("Too many groups, '%s' not created\n", name);
+        return;
+    }
+    Group *g = &groups[id];
+    g->num_selectors = n;
+    memcpy(g->selectors, selectors, sizeof(selectors));
+    group_rebuild(id);
+    int count = g->count;
+    pthread_rwlock_unlock(&garden_lock);
+
+    printf("Group '%s' has %d flowers.\n", name, count);
+}
+
+// UNGROUP <name> forgets the patterns, flowers that carry the name as a tag stay in it
+static void remove_group(const char *name) {
+    pthread_rwlock_wrlock(&garden_lock);
+    int id = group_find(name);
+    int left = 0;
+    if (id >= 0) {
+        groups[id].num_selectors = 0;
+        group_rebuild(id);
+        left = groups[id].count;
+        group_drop_if_unused(id);
+    }
+    pthread_rwlock_unlock(&garden_lock);
+
+    if (id < 0) {
+        printf("No group named '%s'.\n", name);
+    } else if (left > 0) {
+        printf("Group '%s' removed, it is still a tag on %d flowers.\n", name, left);
+    } else {
+        printf("Group '%s' removed.\n", name);
+    }
+}
+
+static void list_groups(void) {
+    pthread_rwlock_rdlock(&garden_lock);
+    printf("Groups:\n");
+    for (int id = 0; id < group_high; id++) {
+        Group *g = &groups[id];
+        if (!g->in_use) continue;
+        printf("  %s: %d flowers", g->name, g->count);
+        for (int k = 0; k < g->num_selectors; k++) {
+            printf("%s%s", k == 0 ? " (" : " ", g->selectors[k]);
+        }
+        printf("%s\n", g->num_selectors > 0 ? ")" : " (tag)");
     }
+    pthread_rwlock_unlock(&garden_lock);
 }
 
 // lists all flowers,,, reallt just for testing and debugging
 static void list_flowers() {
-    pthread_mutex_lock(&garden_mutex);
-    printf("Current flowers in the garden:\n");
-    for (int i = 0; i < MAX_FLOWERS; i++) {
-        if (garden[i].in_use) {
-            printf("  %s (fd=%d)\n", garden[i].name, garden[i].connfd);
+    pthread_rwlock_rdlock(&garden_lock);
+    printf("Current flowers in the garden (%d):\n", garden_count);
+    for (int i = 0; i < garden_count; i++) {
+        FlowerEntry *e = garden_slot(garden_live[i]);
+        printf("  %s (fd=%d)", e->name, e->connfd);
+        for (int t = 0; t < e->num_tags; t++) {
+            printf("%s%s", t == 0 ? " tags=" : ",", e->tags[t]);
         }
+        if (atomic_load(&e->stale)) {
+            printf(" STALE (quiet for %.1fs)", (now_ms() - atomic_load(&e->last_rx_ms)) / 1000.0);
+        }
+        printf("\n");
     }
-    pthread_mutex_unlock(&garden_mutex);
+    pthread_rwlock_unlock(&garden_lock);
 }
 
 // shows whatever the last status was for each flower
+// statuses are stored as numbers so they only get turned back into text right here
 static void print_status_all() {
-    pthread_mutex_lock(&garden_mutex);
+    int64_t now = now_ms();
+
+    pthread_rwlock_rdlock(&garden_lock);
     printf("Flower Status:\n");
-    for (int i = 0; i < MAX_FLOWERS; i++) {
-        if (garden[i].in_use) {
-            if (garden[i].last_status[0] != '\0') {
-                printf("  %s: %s\n", garden[i].name, garden[i].last_status);
-            } else {
-                printf("  %s: (no status yet)\n", garden[i].name);
-            }
+    for (int i = 0; i < garden_count; i++) {
+        int slot = garden_live[i];
+        FlowerEntry *e = garden_slot(slot);
+
+        FlowerStatusFrame fr;
+        int64_t rx;
+        int predicted = status_view(slot, now, &fr, &rx);
+        if (fr.num_petals > 0) {
+            char line[256];
+            Flower_formatStatusFrame(&fr, e->name, line, sizeof(line));
+            const char *how = predicted ? "predicted, last report" : "";
+            printf("  %s: %s (%s%s%.1fs ago)\n", e->name, line, how, how[0] ? " " : "",
+                   (double)(now - rx) / 1000.0);
+        } else {
+            printf("  %s: (no status yet)\n", e->name);
+        }
+    }
+    pthread_rwlock_unlock(&garden_lock);
+}
+
+// how many flowers are in the given state, NONE counts the ones with no status yet
+// every row is read through its seqlock so a flower is counted from one whole report
+static int count_flowers_in_state(FlowerState state) {
+    int count = 0;
+    int64_t now = now_ms();
+    pthread_rwlock_rdlock(&garden_lock);
+    for (int i = 0; i < garden_count; i++) {
+        FlowerStatusFrame fr;
+        status_view(garden_live[i], now, &fr, NULL);
+        FlowerState st = (fr.num_petals == 0) ? FLOWER_STATE_NONE
+                       : (fr.moving ? FLOWER_STATE_MOVING : FLOWER_STATE_IDLE);
+        count += (st == state);
+    }
+    pthread_rwlock_unlock(&garden_lock);
+    return count;
+}
+
+// mean angle of one petal index (or every petal when petal < 0) across all reporting flowers
+// angles and num_petals always come from the same report
+static double mean_petal_angle(int petal, long *samples) {
+    uint64_t sum = 0;
+    long n = 0;
+    int first = (petal < 0) ? 0 : petal;
+    int last  = (petal < 0) ? FLOWER_MAX_PETALS - 1 : petal;
+    int64_t now = now_ms();
+
+    pthread_rwlock_rdlock(&garden_lock);
+    for (int i = 0; i < garden_count; i++) {
+        FlowerStatusFrame fr;
+        status_view(garden_live[i], now, &fr, NULL);
+        for (int p = first; p <= last && p < fr.num_petals; p++) {
+            sum += fr.angles[p];
+            n++;
         }
     }
-    pthread_mutex_unlock(&garden_mutex);
+    pthread_rwlock_unlock(&garden_lock);
+
+    if (samples != NULL) *samples = n;
+    return (n > 0) ? (double)sum / (double)n : 0.0;
+}
+
+// COUNT [IDLE|MOVING|NONE] on the console
+static void print_state_counts(const char *which) {
+    int idle   = count_flowers_in_state(FLOWER_STATE_IDLE);
+    int moving = count_flowers_in_state(FLOWER_STATE_MOVING);
+    int none   = count_flowers_in_state(FLOWER_STATE_NONE);
+
+    if (which[0] == '\0' || strcasecmp(which, "MOVING") == 0) printf("  MOVING  %d\n", moving);
+    if (which[0] == '\0' || strcasecmp(which, "IDLE") == 0)   printf("  IDLE    %d\n", idle);
+    if (which[0] == '\0' || strcasecmp(which, "NONE") == 0)   printf("  NONE    %d\n", none);
+}
+
+// MEAN [petal] on the console
+static void print_mean_angle(const char *which) {
+    int petal = -1;
+    if (which[0] != '\0') {
+        petal = atoi(which);
+        if (petal < 0 || petal >= FLOWER_MAX_PETALS) {
+            printf("Petal index must be 0..%d\n", FLOWER_MAX_PETALS - 1);
+            return;
+        }
+    }
+    long samples;
+    double mean = mean_petal_angle(petal, &samples);
+    if (samples == 0) {
+        printf("No petal angles reported yet.\n");
+    } else if (petal < 0) {
+        printf("Mean petal angle: %.2f deg over %ld petals\n", mean, samples);
+    } else {
+        printf("Mean angle of petal %d: %.2f deg over %ld flowers\n", petal, mean, samples);
+    }
+}
+
+// prints the fan-out counters, mostly to check that batching actually saves syscalls
+static void print_net_stats(void) {
+    unsigned long broadcasts = stat_total(STAT_BROADCASTS);
+    unsigned long enqueued   = stat_total(STAT_ENQUEUED);
+    unsigned long wakeups    = stat_total(STAT_WAKEUPS);
+    unsigned long writevs    = stat_total(STAT_WRITEV_CALLS);
+    unsigned long written    = stat_total(STAT_MSGS_WRITTEN);
+    unsigned long bytes      = stat_total(STAT_BYTES_WRITTEN);
+
+    printf("Network stats:\n");
+    printf("  broadcasts:        %lu\n", broadcasts);
+    printf("  messages queued:   %lu\n", enqueued);
+    printf("  messages written:  %lu (%lu bytes)\n", written, bytes);
+    printf("  writev syscalls:   %lu (%.2f messages each)\n",
+           writevs, writevs ? (double)written / (double)writevs : 0.0);
+    printf("  reactor wakeups:   %lu\n", wakeups);
+    if (broadcasts > 0) {
+        printf("  syscalls/broadcast: %.2f\n",
+               (double)(writevs + wakeups) / (double)broadcasts);
+    }
+
+    HistogramSnap status, fanout;
+    memset(&status, 0, sizeof(status));
+    memset(&fanout, 0, sizeof(fanout));
+    for (int i = 0; i < STAT_SHARDS; i++) {
+        Histogram_snapshot(&stat_shards[i].status_ns, &status);
+        Histogram_snapshot(&stat_shards[i].fanout_ns, &fanout);
+    }
+    printf("  messages read:     %lu (%lu bytes, %lu statuses)\n",
+           stat_total(STAT_MSGS_READ), stat_total(STAT_BYTES_READ), stat_total(STAT_STATUSES));
+    printf("  commands dropped:  %lu\n", stat_total(STAT_DROPPED));
+    printf("  status ingest:     p50 %.1f us  p99 %.1f us  p99.9 %.1f us\n",
+           HistogramSnap_percentile(&status, 0.5) / 1000.0,
+           HistogramSnap_percentile(&status, 0.99) / 1000.0,
+           HistogramSnap_percentile(&status, 0.999) / 1000.0);
+    printf("  command fan-out:   p50 %.1f us  p99 %.1f us  p99.9 %.1f us\n",
+           HistogramSnap_percentile(&fanout, 0.5) / 1000.0,
+           HistogramSnap_percentile(&fanout, 0.99) / 1000.0,
+           HistogramSnap_percentile(&fanout, 0.999) / 1000.0);
+}
+
+// everything above and a look at every flower, in the Prometheus text format
+// counters are labelled by the thread that counted them so a lopsided reactor shows up,
+// queue depths and staleness are worked out right now from the registry under the read lock
+// nothing here is per flower on purpose, a label per flower would be a million series
+static void build_metrics(MetricsText *t) {
+    static const struct {
+        int which;
+        const char *name;
+        const char *help;
+    } counters[] = {
+        { STAT_MSGS_READ,     "garden_messages_in_total",   "Lines and frames received from flowers" },
+        { STAT_BYTES_READ,    "garden_bytes_in_total",      "Bytes received from flowers" },
+        { STAT_STATUSES,      "garden_statuses_total",      "Statuses and deltas that updated a flowers row" },
+        { STAT_MSGS_WRITTEN,  "garden_messages_out_total",  "Messages fully written to flowers" },
+        { STAT_BYTES_WRITTEN, "garden_bytes_out_total",     "Bytes written to flowers" },
+        { STAT_WRITEV_CALLS,  "garden_writev_calls_total",  "writev syscalls made by the reactors" },
+        { STAT_ENQUEUED,      "garden_enqueued_total",      "Message references put into flower queues" },
+        { STAT_DROPPED,       "garden_dropped_total",       "Commands thrown away because a flower queue was full" },
+        { STAT_WAKEUPS,       "garden_wakeups_total",       "eventfd writes to poke a reactor" },
+        { STAT_BROADCASTS,    "garden_broadcasts_total",    "Commands sent to all, a group or a glob" },
+        { STAT_EVICTIONS,     "garden_evictions_total",     "Flowers disconnected for being quiet longer than -e" },
+    };
+    int ncounters = (int)(sizeof(counters) / sizeof(counters[0]));
+
+    for (int k = 0; k < ncounters; k++) {
+        Metrics_writeHeader(t, counters[k].name, "counter", counters[k].help);
+        for (int i = 0; i < STAT_SHARDS; i++) {
+            char label[32];
+            if (i < num_reactors)              snprintf(label, sizeof(label), "thread=\"reactor%d\"", i);
+            else if (i == STAT_SHARD_CONSOLE)  snprintf(label, sizeof(label), "thread=\"console\"");
+            else if (i == STAT_SHARD_OTHER)    snprintf(label, sizeof(label), "thread=\"other\"");
+            else continue;
+            unsigned long v = atomic_load_explicit(&stat_shards[i].counter[counters[k].which],
+                                                   memory_order_relaxed);
+            Metrics_writeSample(t, counters[k].name, label, (double)v);
+        }
+    }
+
+    HistogramSnap status, fanout;
+    memset(&status, 0, sizeof(status));
+    memset(&fanout, 0, sizeof(fanout));
+    for (int i = 0; i < STAT_SHARDS; i++) {
+        Histogram_snapshot(&stat_shards[i].status_ns, &status);
+        Histogram_snapshot(&stat_shards[i].fanout_ns, &fanout);
+    }
+    Metrics_writeHistogram(t, "garden_status_ingest_seconds",
+                           "Parsing a status message and updating its row and prediction",
+                           &status, 7, 24, 1e-9);      // 128 ns .. 16 ms
+    Metrics_writeHistogram(t, "garden_fanout_seconds",
+                           "Queueing one console command for every flower it targets",
+                           &fanout, 10, 30, 1e-9);     // 1 us .. 1 s
+
+    // how long ago every flower was last heard from, flowers that never sent a status are
+    // counted on their own since they have no age yet
+    static const double stale_le[] = { 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 300 };
+    enum { NUM_STALE_LE = sizeof(stale_le) / sizeof(stale_le[0]) };
+    unsigned long stale_count[NUM_STALE_LE] = { 0 };
+    unsigned long heard = 0, never = 0, stale = 0, queued = 0, queue_max = 0, queue_full = 0;
+    double stale_sum = 0.0, stale_max = 0.0;
+
+    int64_t now = now_ms();
+    pthread_rwlock_rdlock(&garden_lock);
+    int flowers = garden_count;
+    for (int i = 0; i < garden_count; i++) {
+        int slot = garden_live[i];
+        FlowerEntry *e = garden_slot(slot);
+
+        pthread_mutex_lock(&e->conn->out_lock);
+        unsigned long depth = (unsigned long)e->conn->out_count;
+        pthread_mutex_unlock(&e->conn->out_lock);
+        queued += depth;
+        if (depth > queue_max) queue_max = depth;
+        if (depth >= (unsigned long)out_queue_limit) queue_full++;
+        if (atomic_load_explicit(&e->stale, memory_order_relaxed)) stale++;
+
+        FlowerStatusFrame fr;
+        int64_t rx;
+        status_load(slot, &fr, &rx);
+        if (rx == 0) {
+            never++;
+            continue;
+        }
+        double age = (now > rx) ? (double)(now - rx) / 1000.0 : 0.0;
+        heard++;
+        stale_sum += age;
+        if (age > stale_max) stale_max = age;
+        for (int b = 0; b < NUM_STALE_LE; b++) {
+            if (age <= stale_le[b]) stale_count[b]++;
+        }
+    }
+    pthread_rwlock_unlock(&garden_lock);
+
+    Metrics_writeHeader(t, "garden_flowers", "gauge", "Flowers registered right now");
+    Metrics_writeSample(t, "garden_flowers", NULL, flowers);
+    Metrics_writeHeader(t, "garden_flowers_without_status", "gauge",
+                        "Registered flowers that have not sent a status yet");
+    Metrics_writeSample(t, "garden_flowers_without_status", NULL, (double)never);
+    Metrics_writeHeader(t, "garden_flowers_stale", "gauge",
+                        "Flowers that have been quiet longer than -s");
+    Metrics_writeSample(t, "garden_flowers_stale", NULL, (double)stale);
+
+    Metrics_writeHeader(t, "garden_flower_staleness_seconds", "histogram",
+                        "Time since each flower last sent a status");
+    for (int b = 0; b < NUM_STALE_LE; b++) {
+        MetricsText_printf(t, "garden_flower_staleness_seconds_bucket{le=\"%g\"} %lu\n",
+                           stale_le[b], stale_count[b]);
+    }
+    MetricsText_printf(t, "garden_flower_staleness_seconds_bucket{le=\"+Inf\"} %lu\n", heard);
+    Metrics_writeSample(t, "garden_flower_staleness_seconds_sum", NULL, stale_sum);
+    Metrics_writeSample(t, "garden_flower_staleness_seconds_count", NULL, (double)heard);
+    Metrics_writeHeader(t, "garden_flower_staleness_max_seconds", "gauge",
+                        "Longest time any flower has been quiet");
+    Metrics_writeSample(t, "garden_flower_staleness_max_seconds", NULL, stale_max);
+
+    Metrics_writeHeader(t, "garden_out_queue_messages", "gauge",
+                        "Commands waiting in flower queues, all flowers together");
+    Metrics_writeSample(t, "garden_out_queue_messages", NULL, (double)queued);
+    Metrics_writeHeader(t, "garden_out_queue_max_messages", "gauge",
+                        "Deepest single flower queue");
+    Metrics_writeSample(t, "garden_out_queue_max_messages", NULL, (double)queue_max);
+    Metrics_writeHeader(t, "garden_out_queue_full_flowers", "gauge",
+                        "Flowers whose queue is at the -q limit");
+    Metrics_writeSample(t, "garden_out_queue_full_flowers", NULL, (double)queue_full);
+    Metrics_writeHeader(t, "garden_out_queue_limit_messages", "gauge",
+                        "Per flower queue length set with -q");
+    Metrics_writeSample(t, "garden_out_queue_limit_messages", NULL, out_queue_limit);
+}
+
+static void print_metrics(void) {
+    MetricsText t;
+    MetricsText_init(&t);
+    build_metrics(&t);
+    if (t.len > 0) fwrite(t.data, 1, t.len, stdout);
+    if (t.failed) printf("(out of memory, metrics cut short)\n");
+    MetricsText_free(&t);
+}
+
+// answers one scrape on the metrics socket and hangs up
+// an HTTP GET (curl --unix-socket, or a proxy in front of Prometheus) gets a proper response,
+// anything else (socat, nc -U) just gets the text, and so does a client that says nothing at all
+static void serve_metrics(int fd) {
+    char req[1024];
+    ssize_t n = 0;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, 100) > 0) {
+        n = read(fd, req, sizeof(req) - 1);
+    }
+    int http = (n >= 4 && strncmp(req, "GET ", 4) == 0);
+
+    MetricsText t;
+    MetricsText_init(&t);
+    if (http) {
+        // Content-Length would need the body first, HTTP/1.0 just ends with the connection
+        MetricsText_printf(&t, "HTTP/1.0 200 OK\r\n"
+                               "Content-Type: text/plain; version=0.0.4\r\n"
+                               "Connection: close\r\n\r\n");
+    }
+    build_metrics(&t);
+
+    // a scraper that stops reading should not keep this thread forever
+    struct timeval tv = { .tv_sec = 2, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    size_t off = 0;
+    while (off < t.len) {
+        ssize_t w = write(fd, t.data + off, t.len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        off += (size_t)w;
+    }
+    MetricsText_free(&t);
+}
+
+// scrapes are rare so one thread serving them one at a time is plenty
+static void* metrics_thread(void *arg) {
+    int lfd = (int)(intptr_t)arg;
+    while (1) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            AsyncLog_log(LOG_LEVEL_ERROR, "metrics accept failed: %s\n", strerror(errno));
+            return NULL;
+        }
+        serve_metrics(fd);
+        close(fd);
+    }
+}
+
+// listening unix socket for -m, a socket left over from an earlier run is replaced
+// but anything else that already has that name is left alone
+static int open_metrics_socket(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "metrics socket path is too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket\n", path);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (SA *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        fprintf(stderr, "metrics socket %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void fire_scheduled_cmd(TimerNode *node) {
+    ScheduledCmd *sc = node->arg;
+    uint32_t wake = 0;
+
+    pthread_rwlock_rdlock(&garden_lock);
+    if (sc->slot < garden_num_chunks * GARDEN_CHUNK) {
+        FlowerEntry *e = garden_slot(sc->slot);
+        if (e->in_use && e->gen == sc->gen) {
+            if (sc->shadow_only) shadow_command(sc->slot, sc->msg);
+            else wake = command_flower(sc->slot, e, sc->msg);
+        }
+    }
+    pthread_rwlock_unlock(&garden_lock);
+
+    // our own flush list gets drained right after the timers run, no need to poke ourselves
+    wake_reactors(wake & ~(1u << sc->r->id));
+
+    shared_msg_unref(sc->msg);
+    free(sc);
+}
+
+// hands a command to the reactor of the flowers conn to send at the given time
+// expects garden_lock to be held, returns the bit of the reactor that needs waking (0 if none)
+static uint32_t schedule_cmd(ScheduledCmd *sc, uint64_t at_ms) {
+    Reactor *r = sc->r;
+    sc->node.fn = fire_scheduled_cmd;
+    sc->node.arg = sc;
+    sc->node.expires = at_ms;
+    atomic_fetch_add_explicit(&sc->msg->refs, 1, memory_order_relaxed);
+
+    pthread_mutex_lock(&r->lock);
+    int was_empty = (r->timer_inbox == NULL);
+    sc->node.next = r->timer_inbox;
+    r->timer_inbox = &sc->node;
+    pthread_mutex_unlock(&r->lock);
+
+    return was_empty ? (1u << r->id) : 0;
+}
+
+// a timed command went out to a predicted flower, its copy gets the command at the start time
+// on the reactor of that flower, same timers BLOOM uses
+static uint32_t schedule_shadow(int slot, FlowerEntry *e, SharedMsg *m) {
+    if (!shadow_predicting(slot)) return 0;
+
+    ScheduledCmd *sc = malloc(sizeof(ScheduledCmd));
+    if (sc == NULL) {
+        // better early than never, the flower corrects us once it really starts
+        shadow_command(slot, m);
+        return 0;
+    }
+    memset(sc, 0, sizeof(*sc));
+    sc->r = e->conn->r;
+    sc->slot = slot;
+    sc->gen = e->gen;
+    sc->msg = m;
+    sc->shadow_only = 1;
+    return schedule_cmd(sc, (uint64_t)m->at_ms);
 }
 
 // continure checking garden until everybody is gone
 // used during quit so the server doesnt end before clients finish closing
+// sleeps on garden_empty_cond so it returns the moment the last flower leaves, the timeout is
+// only there to say what it is still waiting for once a second
+// a flower that never leaves is evicted by the sweeper after evict_ms, so this does end
 static void wait_for_all_flowers_to_terminate(void) {
+    pthread_mutex_lock(&garden_empty_lock);
     while (1) {
-        pthread_mutex_lock(&garden_mutex);
-        int active = 0;
-        for (int i = 0; i < MAX_FLOWERS; i++) {
-            if (garden[i].in_use) {
-                active = 1;
-                break;
-            }
-        }
-        pthread_mutex_unlock(&garden_mutex);
+        pthread_rwlock_rdlock(&garden_lock);
+        int active = garden_count;
+        pthread_rwlock_unlock(&garden_lock);
 
         if (!active) {
             printf("All flowers have closed and disconnected.\n");
             break;
         }
 
-        printf("Waiting for flowers to close and disconnect...\n");
-        sleep(1);
+        printf("Waiting for %d flower%s to close and disconnect...\n", active, active == 1 ? "" : "s");
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        pthread_cond_timedwait(&garden_empty_cond, &garden_empty_lock, &ts);
+    }
+    pthread_mutex_unlock(&garden_empty_lock);
+}
+
+// the one liveness check for the whole garden, a recurring timer on reactor 0
+// a flower nobody heard from in stale_ms is marked stale (LIST and the metrics show it),
+// one that stays quiet for evict_ms gets disconnected like a half open socket would deserve,
+// the owning reactor does the actual close so this never touches another reactors conns
+// every flower sends at least a heartbeat every few seconds (-H on the client, default 2 s)
+static TimerNode sweep_timer;
+
+static void sweep_flowers(TimerNode *node) {
+    Reactor *r = node->arg;
+    int64_t now = now_ms();
+    uint32_t wake = 0;
+
+    pthread_rwlock_rdlock(&garden_lock);
+    for (int i = 0; i < garden_count; i++) {
+        FlowerEntry *e = garden_slot(garden_live[i]);
+        int64_t quiet = now - atomic_load_explicit(&e->last_rx_ms, memory_order_relaxed);
+
+        if (evict_ms > 0 && quiet >= evict_ms) {
+            uint32_t bit = kick_conn(e->conn);
+            if (bit != 0) {
+                wake |= bit;
+                stat_add(STAT_EVICTIONS, 1);
+                AsyncLog_log(LOG_LEVEL_WARN, "Flower '%s' quiet for %lld ms, disconnecting it\n",
+                             e->name, (long long)quiet);
+            }
+        } else if (stale_ms > 0 && quiet >= stale_ms && !atomic_load(&e->stale)) {
+            atomic_store(&e->stale, 1);
+            AsyncLog_log(LOG_LEVEL_WARN, "Flower '%s' quiet for %lld ms, marking it stale\n",
+                         e->name, (long long)quiet);
+        }
     }
+    pthread_rwlock_unlock(&garden_lock);
+    wake_reactors(wake);
+
+    TimerWheel_add(&r->timers, node, (uint64_t)now + SWEEP_EVERY_MS);
 }
 
 // this is the "BLOOM" garden command where each flower gets SEQ1 or SEQ2 chosen randomly
 // with an also random delay in between so they don't all move at exactly the same time
+// every flower gets a timer on its reactor up front so the console is free again right away,
+// the flower could leave before its turn so the timer remembers slot and generation
 static void run_garden_bloom_sequence(void) {
-    int fds[MAX_FLOWERS];
+    // only two distinct payloads no matter how big the garden is
+    SharedMsg *seq[2];
+    seq[0] = shared_msg_new("SEQ1\n", 5);
+    seq[1] = shared_msg_new("SEQ2\n", 5);
+    if (seq[0] == NULL || seq[1] == NULL) {
+        printf("malloc failed for BLOOM\n");
+        if (seq[0] != NULL) shared_msg_unref(seq[0]);
+        if (seq[1] != NULL) shared_msg_unref(seq[1]);
+        return;
+    }
+
+    uint64_t at = (uint64_t)now_ms();
+    uint64_t start = at;
+    uint32_t wake = 0;
     int count = 0;
 
-    pthread_mutex_lock(&garden_mutex);
-    for (int i = 0; i < MAX_FLOWERS; i++) {
-        if (garden[i].in_use) {
-            fds[count++] = garden[i].connfd;
+    pthread_rwlock_rdlock(&garden_lock);
+    for (int i = 0; i < garden_count; i++) {
+        int slot = garden_live[i];
+        FlowerEntry *e = garden_slot(slot);
+
+        ScheduledCmd *sc = malloc(sizeof(ScheduledCmd));
+        if (sc == NULL) {
+            printf("malloc failed for BLOOM, only %d flowers scheduled\n", count);
+            break;
         }
+        memset(sc, 0, sizeof(*sc));
+        sc->r    = e->conn->r;
+        sc->slot = slot;
+        sc->gen  = e->gen;
+        sc->msg  = seq[rand() % 2];
+        wake |= schedule_cmd(sc, at);
+        count++;
+
+        at += 400 + (rand() % 500);  // just anywhere between 400 and 899 ms
     }
-    pthread_mutex_unlock(&garden_mutex);
+    pthread_rwlock_unlock(&garden_lock);
+    wake_reactors(wake);
+
+    shared_msg_unref(seq[0]);
+    shared_msg_unref(seq[1]);
 
     if (count == 0) {
         printf("No flowers connected for BLOOM.\n");
         return;
     }
+    stat_add(STAT_BROADCASTS, 1);
+    printf("BLOOM scheduled for %d flowers over the next %.1f seconds.\n",
+           count, (double)(at - start) / 1000.0);
+}
 
-    printf("Starting BLOOM sequence for %d flowers.\n", count);
+// copies the value of key=value out of a space separated line like HELLO
+// returns 1 if the key was there
+static int get_field(const char *line, const char *key, char *out, size_t out_size) {
+    size_t klen = strlen(key);
+    const char *p = line;
+    while ((p = strstr(p, key)) != NULL) {
+        if ((p == line || p[-1] == ' ') && p[klen] == '=') {
+            p += klen + 1;
+            size_t i = 0;
+            while (*p != '\0' && *p != ' ' && i < out_size - 1) {
+                out[i++] = *p++;
+            }
+            out[i] = '\0';
+            return 1;
+        }
+        p += klen;
+    }
+    return 0;
+}
 
-    for (int i = 0; i < count; i++) {
-        const char *cmd = (rand() % 2 == 0) ? "SEQ1\n" : "SEQ2\n";
-        sendLine(fds[i], cmd);
+// queues a one off line for a single conn, used for replies like PROTO
+static void reply_line(Conn *c, const char *line, const char *name) {
+    SharedMsg *m = shared_msg_new(line, strlen(line));
+    if (m == NULL) return;
+    uint32_t wake = enqueue_msg(c, m, name, NULL);
+    shared_msg_unref(m);
+    wake_reactors(wake);
+}
 
-        int delay_ms = 400 + (rand() % 500);  // just anywhere between 400 and 899 ms
-        usleep(delay_ms * 1000);
+// first line should be HELLO with the flower name.. this doesnt get shown anywhere its just for
+// registration purposes
+//   HELLO name=<name> num_petals=<n> [proto=bin] [predict=1] [tags=<tag>,<tag>...]
+// if the flower asks for proto=bin it gets told its id and switches to binary status frames,
+// and its commands go out as command frames
+// returns the slot the flower got, -1 if it did not get one
+static int handle_hello(Conn *c, const char *line) {
+    if (strncmp(line, "HELLO", 5) != 0) {
+        AsyncLog_log(LOG_LEVEL_WARN, "Expected HELLO, got: %s\n", line);
+        return -1;
     }
 
-    printf("BLOOM commands sent.\n");
-}
+    char flower_name[32];
+    if (!get_field(line, "name", flower_name, sizeof(flower_name))) {
+        AsyncLog_log(LOG_LEVEL_WARN, "HELLO missing name, fd=%d\n", c->fd);
+        return -1;
+    }
+
+    // set before the flower shows up in the registry, a broadcast can pick it up right after
+    // and the flower takes frames as soon as it asked for them, even before our PROTO reply
+    char proto[16];
+    if (get_field(line, "proto", proto, sizeof(proto)) && strcmp(proto, "bin") == 0) {
+        c->proto_bin = 1;
+    }
+
+    char tags[GARDEN_MAX_TAGS * 32];
+    if (!get_field(line, "tags", tags, sizeof(tags))) tags[0] = '\0';
 
-// one thread per client lives here and this handles incoming flower data
-static void* client_thread(void *arg) {
-    int connfd = *(int *)arg;
-    free(arg);
+    char num[16];
+    char predict[8];
+    int num_petals = get_field(line, "num_petals", num, sizeof(num)) ? atoi(num) : FLOWER_MAX_PETALS;
+    int wants_predict = get_field(line, "predict", predict, sizeof(predict)) && strcmp(predict, "1") == 0;
 
-    char buf[MAXLINE];
+    int slot = register_flower(c, flower_name, tags, num_petals, wants_predict);
+    if (slot < 0) return -1;
+
+    if (c->proto_bin) {
+        char reply[64];
+        snprintf(reply, sizeof(reply), "PROTO bin id=%d\n", slot);
+        reply_line(c, reply, flower_name);
+    }
+    if (wants_predict) {
+        // from here on the flower only reports corrections and heartbeats
+        reply_line(c, "PREDICT ok\n", flower_name);
+    }
+    return slot;
+}
 
-    // first line should be HELLO with the flower name.. this doesnt get shown anywhere its just for
-    // registration purposes
-    ssize_t n = read(connfd, buf, MAXLINE - 1);
-    if (n <= 0) {
-        Close(connfd);
-        return NULL;
+// handles one complete line from a flower, newline already stripped
+// after HELLO I mostly care about status lines so I can show a snapshot if needed
+// returns 0 if the connection should be closed
+static int handle_flower_line(Conn *c, const char *line) {
+    if (!c->said_hello) {
+        c->said_hello = 1;
+        // without a slot the sweeper would never see this socket, so it goes right away
+        if (handle_hello(c, line) < 0) return 0;
+        TimerWheel_cancel(&c->r->timers, &c->hello_timer);
+        return 1;
     }
-    buf[n] = '\0';
-    trim_newline(buf);
 
-    if (strncmp(buf, "HELLO", 5) == 0) {
-        char *name_ptr = strstr(buf, "name=");
-        if (name_ptr != NULL) {
-            name_ptr += 5;
-            char flower_name[32];
-            int i = 0;
-            while (*name_ptr != '\0' && *name_ptr != ' ' &&
-                   i < (int)sizeof(flower_name) - 1) {
-                flower_name[i++] = *name_ptr++;
+    if (strncmp(line, "STATUS", 6) == 0) {
+        // parsed once right here, after this it is just numbers
+        int64_t t0 = mono_ns();
+        FlowerStatusFrame fr;
+        if (!Flower_parseStatusLine(line, &fr)) {
+            AsyncLog_log(LOG_LEVEL_WARN, "Bad STATUS from fd=%d: %s\n", c->fd, line);
+            return 1;
+        }
+        int slot = atomic_load_explicit(&c->slot, memory_order_relaxed);
+        if (slot >= 0) {
+            ingest_status(slot, &fr, t0);
+        }
+    } else if (strncmp(line, "TIME ", 5) == 0) {
+        // clock sync, the flower sent its own clock and gets it back along with ours
+        // (see clocksync.h), answered right here on the reactor so the round trip stays short
+        char reply[64];
+        snprintf(reply, sizeof(reply), "TIME %.20s %lld\n", line + 5, (long long)now_ms());
+        reply_line(c, reply, "flower");
+    } else if (strncmp(line, "DELTA", 5) == 0) {
+        // change driven flowers only send the petals that moved, rebuild the full snapshot here
+        int64_t t0 = mono_ns();
+        int slot = atomic_load_explicit(&c->slot, memory_order_relaxed);
+        if (slot >= 0) {
+            FlowerStatusFrame fr;
+            status_load(slot, &fr, NULL);
+            if (Flower_applyDeltaLine(line, &fr)) {
+                ingest_status(slot, &fr, t0);
             }
-            flower_name[i] = '\0';
-            register_flower(connfd, flower_name);
-        } else {
-            printf("HELLO missing name, fd=%d\n", connfd);
         }
     } else {
-        printf("Expected HELLO, got: %s\n", buf);
+        // anything else the client says gets logged
+        AsyncLog_log(LOG_LEVEL_INFO, "From client %d: %s\n", c->fd, line);
+    }
+    return 1;
+}
+
+// handles one complete binary frame from a flower that negotiated proto=bin
+// a full status replaces the snapshot, a delta patches the petals it carries
+static void handle_flower_frame(Conn *c, const unsigned char *frame, size_t len) {
+    int64_t t0 = mono_ns();
+    FlowerStatusFrame fr;
+    int ok = 0;
+
+    if (frame[1] == FLOWER_FRAME_STATUS) {
+        if (!Flower_decodeStatus(frame, len, &fr)) {
+            AsyncLog_log(LOG_LEVEL_WARN, "Bad status frame from fd=%d (%zu bytes)\n", c->fd, len);
+            return;
+        }
+    } else if (frame[1] != FLOWER_FRAME_DELTA) {
+        AsyncLog_log(LOG_LEVEL_WARN, "Unknown frame type %d from fd=%d\n", frame[1], c->fd);
+        return;
+    }
+    int slot = atomic_load_explicit(&c->slot, memory_order_relaxed);
+    if (slot >= 0) {
+        if (frame[1] == FLOWER_FRAME_STATUS) {
+            ok = ((uint32_t)slot == fr.id);
+        } else {
+            status_load(slot, &fr, NULL);
+            ok = Flower_applyDeltaFrame(frame, len, &fr);
+        }
+        if (ok) ingest_status(slot, &fr, t0);
+    }
+
+    if (!ok && slot >= 0) {
+        AsyncLog_log(LOG_LEVEL_WARN, "Dropped frame from fd=%d that did not match its snapshot\n",
+                     c->fd);
+    }
+}
+
+static void free_conn(Conn *c) {
+    for (int i = 0; i < c->out_count; i++) {
+        shared_msg_unref(c->outq[(c->out_head + i) % out_queue_limit]);
+    }
+    free(c->outq);
+    RingBuf_free(&c->in);
+    pthread_mutex_destroy(&c->out_lock);
+    free(c);
+}
+
+static void bury_conn(Reactor *r, Conn *c) {
+    c->dead_next = r->graveyard;
+    r->graveyard = c;
+}
+
+// flower went away (or misbehaved) so drop it from the garden and forget the socket
+// once unregister returns nobody can find this conn through the garden anymore,
+// the only thing that can still point at it is our own flush list
+static void close_conn(Reactor *r, Conn *c) {
+    if (c->closed) return;
+
+    TimerWheel_cancel(&r->timers, &c->hello_timer);
+    unregister_flower(c->fd);
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    Close(c->fd);
+    c->fd = -1;
+
+    pthread_mutex_lock(&r->lock);
+    int still_queued = c->flush_queued;
+    c->closed = 1;
+    pthread_mutex_unlock(&r->lock);
+
+    // if it is still on the flush list the drain will bury it when it gets there
+    if (!still_queued) {
+        bury_conn(r, c);
     }
+}
+
+// turns EPOLLOUT on or off for a conn depending on whether it still has stuff to send
+static void set_want_out(Reactor *r, Conn *c, int want) {
+    if (c->want_out == want) return;
+    struct epoll_event ev;
+    ev.events   = EPOLLIN | EPOLLRDHUP | (want ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(r->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->want_out = want;
+}
+
+// writes as much of the queue as the socket will take
+// everything queued for this flower goes out in one writev instead of one write per command
+// returns 0 if the connection should be closed
+static int flush_conn(Reactor *r, Conn *c) {
+    struct iovec iov[FLUSH_IOV];
 
-    // I mostly care about status lines so I can show a snapshot if needed
     while (1) {
-        n = read(connfd, buf, MAXLINE - 1);
-        if (n <= 0) break;
-
-        buf[n] = '\0';
-        trim_newline(buf);
-
-        if (strncmp(buf, "STATUS", 6) == 0) {
-            pthread_mutex_lock(&garden_mutex);
-            for (int i = 0; i < MAX_FLOWERS; i++) {
-                if (garden[i].in_use && garden[i].connfd == connfd) {
-                    strncpy(garden[i].last_status, buf,
-                            sizeof(garden[i].last_status) - 1);
-                    garden[i].last_status[sizeof(garden[i].last_status) - 1] = '\0';
-                    break;
-                }
+        pthread_mutex_lock(&c->out_lock);
+        if (c->kill) {
+            pthread_mutex_unlock(&c->out_lock);
+            return 0;
+        }
+        if (c->out_count == 0) {
+            pthread_mutex_unlock(&c->out_lock);
+            set_want_out(r, c, 0);
+            return 1;
+        }
+        // only this thread ever pops, so these entries stay put once we let go of the lock
+        int batch = (c->out_count < FLUSH_IOV) ? c->out_count : FLUSH_IOV;
+        for (int i = 0; i < batch; i++) {
+            SharedMsg *m = c->outq[(c->out_head + i) % out_queue_limit];
+            iov[i].iov_base = m->data;
+            iov[i].iov_len  = m->len;
+        }
+        pthread_mutex_unlock(&c->out_lock);
+
+        iov[0].iov_base = (char *)iov[0].iov_base + c->out_off;
+        iov[0].iov_len -= c->out_off;
+
+        ssize_t n = writev(c->fd, iov, batch);
+        stat_add(STAT_WRITEV_CALLS, 1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // socket buffer is full, try again when epoll says it drained
+                set_want_out(r, c, 1);
+                return 1;
             }
-            pthread_mutex_unlock(&garden_mutex);
-        } else {
-            // anything else the client says gets logged
-            printf("From client %d: %s\n", connfd, buf);
+            return 0;
+        }
+        stat_add(STAT_BYTES_WRITTEN, (unsigned long)n);
+
+        // figure out how many whole messages that covered, the last one may be partial
+        size_t left = (size_t)n;
+        int done = 0;
+        while (done < batch && left >= iov[done].iov_len) {
+            left -= iov[done].iov_len;
+            done++;
+        }
+
+        SharedMsg *finished[FLUSH_IOV];
+        pthread_mutex_lock(&c->out_lock);
+        for (int i = 0; i < done; i++) {
+            finished[i] = c->outq[c->out_head];
+            c->out_head = (c->out_head + 1) % out_queue_limit;
+        }
+        c->out_count -= done;
+        pthread_mutex_unlock(&c->out_lock);
+
+        c->out_off = (done == 0) ? c->out_off + left : left;
+        for (int i = 0; i < done; i++) {
+            shared_msg_unref(finished[i]);
+        }
+        stat_add(STAT_MSGS_WRITTEN, (unsigned long)done);
+
+        if (done < batch) {
+            // short write means the socket is full, wait for EPOLLOUT
+            set_want_out(r, c, 1);
+            return 1;
+        }
+    }
+}
+
+// grab the whole flush list and work through it
+static void flush_pending(Reactor *r) {
+    pthread_mutex_lock(&r->lock);
+    Conn *list = r->flush_head;
+    r->flush_head = NULL;
+    pthread_mutex_unlock(&r->lock);
+
+    while (list != NULL) {
+        Conn *c = list;
+
+        pthread_mutex_lock(&r->lock);
+        list = c->flush_next;
+        c->flush_queued = 0;
+        int closed = c->closed;
+        pthread_mutex_unlock(&r->lock);
+
+        if (closed) {
+            bury_conn(r, c);
+        } else if (!flush_conn(r, c)) {
+            close_conn(r, c);
+        }
+    }
+}
+
+// somebody poked our eventfd, either there is something to flush or new timers came in
+static void drain_flush_list(Reactor *r) {
+    uint64_t junk;
+    ssize_t n = read(r->wakefd, &junk, sizeof(junk));
+    (void)n;
+    flush_pending(r);
+}
+
+// moves newly scheduled commands into the wheel and fires everything that is due
+// returns the epoll_wait timeout until the next one, -1 if there is nothing pending
+static int run_timers(Reactor *r) {
+    pthread_mutex_lock(&r->lock);
+    TimerNode *list = r->timer_inbox;
+    r->timer_inbox = NULL;
+    pthread_mutex_unlock(&r->lock);
+
+    while (list != NULL) {
+        TimerNode *node = list;
+        list = node->next;
+        TimerWheel_add(&r->timers, node, node->expires);
+    }
+
+    uint64_t now = (uint64_t)now_ms();
+    if (TimerWheel_advance(&r->timers, now) > 0) {
+        flush_pending(r);
+    }
+
+    uint64_t when;
+    if (!TimerWheel_nextExpiry(&r->timers, &when)) return -1;
+    now = (uint64_t)now_ms();
+    if (when <= now) return 0;
+    return (when - now > INT_MAX) ? INT_MAX : (int)(when - now);
+}
+
+// socket is readable so pull in whatever is there and hand off every complete message
+// one read can carry zero, one or a bunch of messages and they are handled in place in the ring
+// binary flowers mix frames and text lines, a frame always starts with FLOWER_FRAME_MAGIC
+// returns 0 if the connection should be closed
+static int read_conn(Conn *c) {
+    ssize_t n = RingBuf_readFrom(&c->in, c->fd);
+    if (n == 0) return 0;
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+    stat_add(STAT_BYTES_READ, (unsigned long)n);
+
+    // anything at all counts as a sign of life for the sweeper
+    int slot = atomic_load_explicit(&c->slot, memory_order_relaxed);
+    if (slot >= 0) {
+        FlowerEntry *e = garden_slot(slot);
+        atomic_store_explicit(&e->last_rx_ms, now_ms(), memory_order_relaxed);
+        if (atomic_load_explicit(&e->stale, memory_order_relaxed) && atomic_exchange(&e->stale, 0)) {
+            AsyncLog_log(LOG_LEVEL_INFO, "Flower '%s' is talking again\n", e->name);
+        }
+    }
+
+    while (1) {
+        const unsigned char *p = (const unsigned char *)RingBuf_peek(&c->in, 1);
+        if (p == NULL) break;
+
+        if (c->proto_bin && p[0] == FLOWER_FRAME_MAGIC) {
+            p = (const unsigned char *)RingBuf_peek(&c->in, FLOWER_FRAME_HEADER);
+            if (p == NULL) break;   // not even the whole header yet
+            size_t flen = Flower_frameLength(p, FLOWER_FRAME_HEADER);
+            if (flen < FLOWER_FRAME_HEADER || flen > FLOWER_FRAME_MAX) {
+                // lost track of the framing, nothing sensible left to do with this flower
+                AsyncLog_log(LOG_LEVEL_WARN, "Corrupt frame from fd=%d, closing\n", c->fd);
+                return 0;
+            }
+            p = (const unsigned char *)RingBuf_peek(&c->in, flen);
+            if (p == NULL) break;   // rest of the frame is still on its way
+            handle_flower_frame(c, p, flen);
+            RingBuf_consume(&c->in, flen);
+            stat_add(STAT_MSGS_READ, 1);
+            continue;
+        }
+
+        const char *line;
+        size_t len;
+        int rc = RingBuf_nextLine(&c->in, &line, &len);
+        if (rc == 0) break;
+        if (rc < 0) {
+            // nobody sends lines this long
+            AsyncLog_log(LOG_LEVEL_WARN, "Line too long from fd=%d, dropping it\n", c->fd);
+            continue;
+        }
+        if (len > 0) {
+            stat_add(STAT_MSGS_READ, 1);
+            if (!handle_flower_line(c, line)) return 0;
+        }
+    }
+    return 1;
+}
+
+static void set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// a socket that connected but never said HELLO is not in the garden so the sweeper cannot see it,
+// this timer gives it evict_ms to introduce itself and is only cancelled once it has a slot
+static void hello_timeout(TimerNode *node) {
+    Conn *c = node->arg;
+    if (atomic_load(&c->slot) >= 0 || c->closed) return;
+    AsyncLog_log(LOG_LEVEL_WARN, "No HELLO from fd=%d in %d ms, closing\n", c->fd, evict_ms);
+    close_conn(c->r, c);
+}
+
+// accept everything that is waiting on the listen socket and add it to this reactors epoll set
+static void accept_flowers(Reactor *r) {
+    char client_hostname[NI_MAXHOST], client_port[NI_MAXSERV];
+
+    while (1) {
+        struct sockaddr_storage clientaddr;
+        socklen_t clientlen = sizeof(struct sockaddr_storage);
+
+        int connfd = accept(listenfd, (SA *)&clientaddr, &clientlen);
+        if (connfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                AsyncLog_log(LOG_LEVEL_ERROR, "accept failed: %s\n", strerror(errno));
+            }
+            return;
+        }
+        set_nonblocking(connfd);
+        // every write is already one writev of the whole queue, Nagle would only sit on it
+        // until the flowers delayed ACK came back (~40 ms on every small OPEN / CLOSE)
+        int one = 1;
+        setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        // numeric only so a slow reverse dns lookup never stalls the whole reactor
+        // and not at all if nobody is going to see the line
+        if (AsyncLog_enabled(LOG_LEVEL_INFO)) {
+            if (getnameinfo((SA *)&clientaddr, clientlen,
+                            client_hostname, sizeof(client_hostname),
+                            client_port, sizeof(client_port),
+                            NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+                strcpy(client_hostname, "?");
+                strcpy(client_port, "?");
+            }
+            AsyncLog_log(LOG_LEVEL_INFO, "New connection from (%s, %s), fd=%d\n",
+                         client_hostname, client_port, connfd);
+        }
+
+        Conn *c = calloc(1, sizeof(Conn));
+        SharedMsg **q = calloc((size_t)out_queue_limit, sizeof(SharedMsg *));
+        if (c == NULL || q == NULL || !RingBuf_init(&c->in, CONN_IN_SIZE, CONN_MAX_LINE)) {
+            AsyncLog_log(LOG_LEVEL_ERROR, "malloc failed\n");
+            free(c);
+            free(q);
+            Close(connfd);
+            continue;
+        }
+        c->fd   = connfd;
+        c->r    = r;
+        c->outq = q;
+        atomic_init(&c->slot, -1);
+        pthread_mutex_init(&c->out_lock, NULL);
+
+        struct epoll_event ev;
+        ev.events   = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, connfd, &ev) < 0) {
+            AsyncLog_log(LOG_LEVEL_ERROR, "epoll_ctl failed for fd=%d\n", connfd);
+            Close(connfd);
+            free_conn(c);
+            continue;
+        }
+        if (evict_ms > 0) {
+            c->hello_timer.fn  = hello_timeout;
+            c->hello_timer.arg = c;
+            TimerWheel_add(&r->timers, &c->hello_timer, (uint64_t)(now_ms() + evict_ms));
+        }
+    }
+}
+
+// the event loop, one of these runs per reactor thread
+// the listen socket is tagged with a NULL pointer, the wake eventfd with the reactor
+// itself and everything else is a Conn
+static void* reactor_loop(void *arg) {
+    Reactor *r = (Reactor *)arg;
+    struct epoll_event events[REACTOR_EVENTS];
+    my_shard = &stat_shards[r->id];
+
+    while (1) {
+        int timeout = run_timers(r);
+        int n = epoll_wait(r->epfd, events, REACTOR_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            AsyncLog_log(LOG_LEVEL_ERROR, "epoll_wait failed in reactor %d\n", r->id);
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == NULL) {
+                accept_flowers(r);
+                continue;
+            }
+            if (tag == (void *)r) {
+                drain_flush_list(r);
+                continue;
+            }
+
+            Conn *c = (Conn *)tag;
+            if (c->closed) continue;
+
+            int keep = 1;
+            if (events[i].events & EPOLLIN) {
+                keep = read_conn(c);
+            } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                keep = 0;
+            }
+            if (keep && (events[i].events & EPOLLOUT)) {
+                keep = flush_conn(r, c);
+            }
+            if (!keep) {
+                close_conn(r, c);
+            }
+        }
+
+        while (r->graveyard != NULL) {
+            Conn *c = r->graveyard;
+            r->graveyard = c->dead_next;
+            free_conn(c);
         }
     }
 
-    unregister_flower(connfd);
-    Close(connfd);
     return NULL;
 }
 
+// every flower is a file descriptor so bump the soft limit as high as we are allowed
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static void print_start_time(int64_t at_ms) {
+    int64_t in = at_ms - now_ms();
+    if (in > 0) printf("Starts at t=%lld (in %lld ms)\n", (long long)at_ms, (long long)in);
+    else printf("Start time t=%lld already passed, starting right away\n", (long long)at_ms);
+}
+
+// pulls a trailing "@+<ms>" (that long from now) or "@t=<ms>" (our clock, see CLOCK) off the
+// console arguments in args, which loses it
+// returns 0 if there is none, -1 if it is malformed, 1 with the start time in *at_ms
+static int split_start_arg(char *args, int64_t *at_ms) {
+    char *tok = strrchr(args, ' ');
+    tok = (tok != NULL) ? tok + 1 : args;
+    if (tok[0] != '@') return 0;
+
+    char *end;
+    long long v;
+    if (tok[1] == '+') {
+        v = strtoll(tok + 2, &end, 10);
+        v += now_ms();
+    } else if (strncmp(tok, "@t=", 3) == 0) {
+        v = strtoll(tok + 3, &end, 10);
+    } else {
+        return -1;
+    }
+    if (*end != '\0' || end == tok + 2 || v <= 0) return -1;
+
+    *at_ms = v;
+    while (tok > args && (tok[-1] == ' ' || tok[-1] == '\t')) tok--;
+    *tok = '\0';
+    return 1;
+}
+
 // this thread is just watching stdin and processing the commands entered into server terminal
 static void* command_thread(void *arg) {
     (void)arg;
+    my_shard = &stat_shards[STAT_SHARD_CONSOLE];
 
-    char line[128];
+    char line[FLOWER_CMD_MAX];
 
     printf("~Blooming Garden Controller~\n");
     printf("Type HELP for commands.\n\n"); // i thought this was a nice touch
@@ -302,7 +2417,7 @@ static void* command_thread(void *arg) {
         if (line[0] == '\0') continue;
 
         // parse into action and target..if there is one because its not reqired
-        char parsebuf[128];
+        char parsebuf[FLOWER_CMD_MAX];
         strncpy(parsebuf, line, sizeof(parsebuf) - 1);
         parsebuf[sizeof(parsebuf) - 1] = '\0';
 
@@ -317,9 +2432,13 @@ static void* command_thread(void *arg) {
         strncpy(action, first, sizeof(action) - 1);
         action[sizeof(action) - 1] = '\0';
 
+        // whatever comes after the target, only the commands with arguments use it
+        const char *rest = "";
         if (second) {
             strncpy(target, second, sizeof(target) - 1);
             target[sizeof(target) - 1] = '\0';
+            rest = line + (second - parsebuf) + strlen(second);
+            while (*rest == ' ' || *rest == '\t') rest++;
         } else {
             target[0] = '\0';
         }
@@ -329,6 +2448,26 @@ static void* command_thread(void *arg) {
             action[i] = (char)toupper((unsigned char)action[i]);
         }
 
+        // fleet queries take an optional argument that is not a flower name
+        if (strcmp(action, "COUNT") == 0) {
+            print_state_counts(target);
+            continue;
+        }
+        if (strcmp(action, "MEAN") == 0) {
+            print_mean_angle(target);
+            continue;
+        }
+        if (strcmp(action, "LOGLEVEL") == 0) {
+            LogLevel level;
+            if (AsyncLog_parseLevel(target, &level)) {
+                AsyncLog_setLevel(level);
+                printf("Log level is now %s.\n", target);
+            } else {
+                printf("LOGLEVEL takes error, warn, info or debug\n");
+            }
+            continue;
+        }
+
         // no target means its one of the simple commands
         if (target[0] == '\0') {
             if (strcmp(action, "LIST") == 0) {
@@ -339,6 +2478,22 @@ static void* command_thread(void *arg) {
                 print_status_all();
                 continue;
             }
+            if (strcmp(action, "NETSTAT") == 0) {
+                print_net_stats();
+                continue;
+            }
+            if (strcmp(action, "METRICS") == 0) {
+                print_metrics();
+                continue;
+            }
+            if (strcmp(action, "CLOCK") == 0) {
+                printf("Server clock: t=%lld\n", (long long)now_ms());
+                continue;
+            }
+            if (strcmp(action, "GROUPS") == 0) {
+                list_groups();
+                continue;
+            }
             if (strcmp(action, "HELP") == 0) {
                 print_help();
                 continue;
@@ -355,6 +2510,10 @@ static void* command_thread(void *arg) {
                 broadcast_command("TERMINATE\n");  // graceful shutdown on clients
 
                 wait_for_all_flowers_to_terminate();
+                unsigned long dropped = AsyncLog_stop();
+                if (dropped > 0) {
+                    printf("(%lu log lines dropped, output could not keep up)\n", dropped);
+                }
                 printf("Shutting down server.\n");
                 exit(0);
             }
@@ -364,7 +2523,7 @@ static void* command_thread(void *arg) {
             continue;
         }
 
-        // here we use a target which can be ALL or a specific flower name
+        // here we use a target which can be ALL, a flower name, a group / tag or a glob
         int to_all = 0;
         {
             char tgt_upper[32];
@@ -378,6 +2537,30 @@ static void* command_thread(void *arg) {
             }
         }
 
+        if (strcmp(action, "GROUP") == 0 || strcmp(action, "UNGROUP") == 0) {
+            if (to_all)
+                printf("'%s' always means every flower, pick another group name\n", target);
+            else if (action[0] == 'G')
+                define_group(target, rest);
+            else
+                remove_group(target);
+            continue;
+        }
+
+        // a start time at the end is split off here and goes out as " @t=<ms>" on the line,
+        // every flower then holds the command until that moment on its own clock
+        char args[FLOWER_CMD_MAX];
+        char start[32] = "";
+        int64_t start_at = 0;
+        strncpy(args, rest, sizeof(args) - 1);
+        args[sizeof(args) - 1] = '\0';
+        int timed = split_start_arg(args, &start_at);
+        if (timed < 0) {
+            printf("Start time has to be @+<ms> or @t=<server_ms>\n");
+            continue;
+        }
+        if (timed) snprintf(start, sizeof(start), " @t=%lld", (long long)start_at);
+
         // these are the actions I actually forward to the client sockets
         if (strcmp(action, "OPEN") == 0 ||
             strcmp(action, "CLOSE") == 0 ||
@@ -385,13 +2568,36 @@ static void* command_thread(void *arg) {
             strcmp(action, "SEQ2") == 0 ||
             strcmp(action, "TERMINATE") == 0) {
 
-            char sendbuf[32];
-            snprintf(sendbuf, sizeof(sendbuf), "%.30s\n", action);
+            char sendbuf[64];
+            snprintf(sendbuf, sizeof(sendbuf), "%.30s%s\n", action, start);
 
             if (to_all)
                 broadcast_command(sendbuf);
             else
-                send_to_one(target, sendbuf);
+                send_to_target(target, sendbuf);
+            if (timed) print_start_time(start_at);
+
+        } else if (strcmp(action, "SET") == 0 ||
+                   strcmp(action, "ANGLE") == 0 ||
+                   strcmp(action, "KEYS") == 0) {
+
+            // checked here once so a typo gets an answer instead of being ignored by every flower
+            char sendbuf[FLOWER_CMD_MAX + 8];
+            int n = snprintf(sendbuf, sizeof(sendbuf), "%s %s%s\n", action, args, start);
+            size_t cmd_len = strlen(action) + 1 + strlen(args);   // in front of the start time
+            FlowerCmd check;
+            if (n < 0 || (size_t)n > FLOWER_CMD_MAX ||
+                Flower_parseCommand(sendbuf, cmd_len, &check) == FLOWER_OP_NONE) {
+                printf("Bad arguments for %s: %s\n", action, args);
+                print_help();
+                continue;
+            }
+
+            if (to_all)
+                broadcast_command(sendbuf);
+            else
+                send_to_target(target, sendbuf);
+            if (timed) print_start_time(start_at);
 
         } else {
             printf("Unknown action: %s\n", action);
@@ -402,54 +2608,137 @@ static void* command_thread(void *arg) {
     return NULL;
 }
 
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-r reactors] [-q queue_len] [-o drop|disconnect] [-m metrics_socket]\n"
+                    "          [-l error|warn|info|debug] [-L lines_per_sec] [-s stale_ms] [-e evict_ms] <port>\n",
+            prog);
+    exit(0);
+}
+
 // main just sets up the listening socket, spins off the command thread,
-// and then sits in an accept() loop making a client thread for each flower
+// starts the reactor threads and then becomes reactor 0 itself
 int main(int argc, char **argv) {
-    int listenfd;
-    socklen_t clientlen;
-    struct sockaddr_storage clientaddr;
-    char client_hostname[MAXLINE], client_port[MAXLINE];
-
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
-        exit(0);
+    int opt;
+    const char *metrics_path = NULL;
+    while ((opt = getopt(argc, argv, "r:q:o:m:l:L:s:e:")) != -1) {
+        switch (opt) {
+        case 'r':
+            num_reactors = atoi(optarg);
+            if (num_reactors < 1) num_reactors = 1;
+            if (num_reactors > MAX_REACTORS) num_reactors = MAX_REACTORS;
+            break;
+        case 'q':
+            out_queue_limit = atoi(optarg);
+            if (out_queue_limit < 1) out_queue_limit = 1;
+            break;
+        case 'o':
+            if (strcmp(optarg, "drop") == 0) {
+                overflow_policy = OVERFLOW_DROP;
+            } else if (strcmp(optarg, "disconnect") == 0) {
+                overflow_policy = OVERFLOW_DISCONNECT;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'm':
+            metrics_path = optarg;
+            break;
+        case 'l': {
+            LogLevel level;
+            if (!AsyncLog_parseLevel(optarg, &level)) usage(argv[0]);
+            AsyncLog_setLevel(level);
+            break;
+        }
+        case 'L':
+            AsyncLog_setRateLimit(atoi(optarg), 1000);
+            break;
+        case 's':
+            stale_ms = atoi(optarg);
+            if (stale_ms < 0) stale_ms = 0;
+            break;
+        case 'e':
+            evict_ms = atoi(optarg);
+            if (evict_ms < 0) evict_ms = 0;
+            break;
+        default:
+            usage(argv[0]);
+        }
     }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+    const char *port = argv[optind];
 
     srand((unsigned int)time(NULL));  // seed RNG for BLOOM
+    // reactors log through here, the console keeps printing its own answers directly
+    AsyncLog_start(stdout, 64 * 1024);
+    make_cmd_frames();
+    raise_fd_limit();
+
+    listenfd = Open_listenfd((char *)port);
+    set_nonblocking(listenfd);
+
+    for (int i = 0; i < num_reactors; i++) {
+        reactors[i].id     = i;
+        reactors[i].epfd   = epoll_create1(EPOLL_CLOEXEC);
+        reactors[i].wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        pthread_mutex_init(&reactors[i].lock, NULL);
+        TimerWheel_init(&reactors[i].timers, (uint64_t)now_ms());
+        if (reactors[i].epfd < 0 || reactors[i].wakefd < 0) {
+            fprintf(stderr, "epoll_create1/eventfd failed\n");
+            exit(1);
+        }
 
-    listenfd = Open_listenfd(argv[1]);
+        // EPOLLEXCLUSIVE so a new flower only wakes one reactor instead of all of them
+        struct epoll_event ev;
+        ev.events   = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(reactors[i].epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0) {
+            fprintf(stderr, "epoll_ctl on listen socket failed\n");
+            exit(1);
+        }
+
+        ev.events   = EPOLLIN;
+        ev.data.ptr = &reactors[i];
+        if (epoll_ctl(reactors[i].epfd, EPOLL_CTL_ADD, reactors[i].wakefd, &ev) < 0) {
+            fprintf(stderr, "epoll_ctl on wake eventfd failed\n");
+            exit(1);
+        }
+    }
+
+    // reactor 0 sweeps the whole garden, no other thread touches its wheel before it starts
+    if (stale_ms > 0 || evict_ms > 0) {
+        sweep_timer.fn  = sweep_flowers;
+        sweep_timer.arg = &reactors[0];
+        TimerWheel_add(&reactors[0].timers, &sweep_timer, (uint64_t)now_ms() + SWEEP_EVERY_MS);
+    }
 
     pthread_t cmd_tid;
     pthread_create(&cmd_tid, NULL, command_thread, NULL);
     pthread_detach(cmd_tid);
 
-    printf("Garden server listening on port %s\n\n", argv[1]);
-
-    while (1) {
-        clientlen = sizeof(struct sockaddr_storage);
-        int *connfdp = malloc(sizeof(int));
-        if (connfdp == NULL) {
-            printf("malloc failed\n");
-            continue;
-        }
-
-        *connfdp = Accept(listenfd, (SA *)&clientaddr, &clientlen);
+    if (metrics_path != NULL) {
+        int mfd = open_metrics_socket(metrics_path);
+        if (mfd < 0) exit(1);
+        pthread_t metrics_tid;
+        pthread_create(&metrics_tid, NULL, metrics_thread, (void *)(intptr_t)mfd);
+        pthread_detach(metrics_tid);
+        printf("Metrics on unix socket %s\n", metrics_path);
+    }
 
-        Getnameinfo((SA *)&clientaddr, clientlen,
-                    client_hostname, MAXLINE,
-                    client_port, MAXLINE, 0);
-        printf("New connection from (%s, %s), fd=%d\n",
-               client_hostname, client_port, *connfdp);
+    printf("Garden server listening on port %s (%d reactor%s)\n\n",
+           port, num_reactors, num_reactors == 1 ? "" : "s");
 
-        pthread_t tid;
-        if (pthread_create(&tid, NULL, client_thread, connfdp) != 0) {
-            printf("pthread_create failed\n");
-            Close(*connfdp);
-            free(connfdp);
-            continue;
+    for (int i = 1; i < num_reactors; i++) {
+        if (pthread_create(&reactors[i].tid, NULL, reactor_loop, &reactors[i]) != 0) {
+            fprintf(stderr, "pthread_create failed for reactor %d\n", i);
+            exit(1);
         }
-        pthread_detach(tid);
+        pthread_detach(reactors[i].tid);
     }
 
+    reactors[0].tid = pthread_self();
+    reactor_loop(&reactors[0]);
+
     return 0;
-}
\ No newline at end of file
+}
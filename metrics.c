@@ -0,0 +1,147 @@
+// metrics.c
+// histograms and the Prometheus text output behind the servers metrics endpoint
+
+// the buckets are the usual HDR histogram layout, the top bits of a value pick the power of two
+// and the next HIST_SUB_BITS bits pick the bucket inside it, so recording is a clz and a shift
+// and the whole thing is a fixed 4 KB no matter what range of values shows up
+
+#include "metrics.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int bucket_of(uint64_t v) {
+    if (v < HIST_SUB) return (int)v;
+    int e = 63 - __builtin_clzll(v);   // v is in [2^e, 2^(e+1))
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB + (int)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+// first value past bucket i, UINT64_MAX for the very top one
+static uint64_t bucket_end(int i) {
+    if (i < HIST_SUB) return (uint64_t)i + 1;
+    int shift = i / HIST_SUB - 1;
+    uint64_t start = (uint64_t)(HIST_SUB + i % HIST_SUB) << shift;
+    uint64_t width = (uint64_t)1 << shift;
+    return (start > UINT64_MAX - width) ? UINT64_MAX : start + width;
+}
+
+void Histogram_record(Histogram *h, uint64_t v) {
+    atomic_fetch_add_explicit(&h->buckets[bucket_of(v)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+}
+
+void Histogram_snapshot(const Histogram *h, HistogramSnap *snap) {
+    // count is read last and rebuilt from the buckets so _count always matches the +Inf bucket
+    // even if a record landed half way through this loop
+    uint64_t total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        uint64_t n = atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        snap->buckets[i] += n;
+        total += n;
+    }
+    snap->sum   += atomic_load_explicit(&h->sum, memory_order_relaxed);
+    snap->count += total;
+}
+
+uint64_t HistogramSnap_percentile(const HistogramSnap *snap, double q) {
+    if (snap->count == 0) return 0;
+    if (q < 0.0) q = 0.0;
+    if (q > 1.0) q = 1.0;
+
+    double exact = q * (double)snap->count;
+    uint64_t want = (uint64_t)exact;
+    if ((double)want < exact || want == 0) want++;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += snap->buckets[i];
+        if (seen >= want) return bucket_end(i) - 1;
+    }
+    return UINT64_MAX;
+}
+
+void MetricsText_init(MetricsText *t) {
+    t->data   = NULL;
+    t->len    = 0;
+    t->cap    = 0;
+    t->failed = 0;
+}
+
+void MetricsText_free(MetricsText *t) {
+    free(t->data);
+    MetricsText_init(t);
+}
+
+void MetricsText_printf(MetricsText *t, const char *fmt, ...) {
+    if (t->failed) return;
+    while (1) {
+        size_t room = t->cap - t->len;
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(t->data ? t->data + t->len : NULL, room, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if ((size_t)n < room) {
+            t->len += (size_t)n;
+            return;
+        }
+
+        // did not fit, double until it does and print again
+        size_t cap = t->cap ? t->cap : 4096;
+        while (cap - t->len <= (size_t)n) cap *= 2;
+        char *p = realloc(t->data, cap);
+        if (p == NULL) {
+            t->failed = 1;
+            return;
+        }
+        t->data = p;
+        t->cap  = cap;
+    }
+}
+
+void Metrics_writeHeader(MetricsText *t, const char *name, const char *type, const char *help) {
+    MetricsText_printf(t, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// counters are whole numbers and should come out as such, not as 1.2345e+10
+static void write_value(MetricsText *t, double value) {
+    if (value > -9007199254740992.0 && value < 9007199254740992.0 &&
+        value == (double)(long long)value) {
+        MetricsText_printf(t, " %.0f\n", value);
+    } else {
+        MetricsText_printf(t, " %.9g\n", value);
+    }
+}
+
+void Metrics_writeSample(MetricsText *t, const char *name, const char *labels, double value) {
+    if (labels != NULL && labels[0] != '\0') {
+        MetricsText_printf(t, "%s{%s}", name, labels);
+    } else {
+        MetricsText_printf(t, "%s", name);
+    }
+    write_value(t, value);
+}
+
+// bucket boundaries sit exactly on the powers of two, so le="2^p" counts everything below 2^p
+// (Prometheus says less or equal, one unit off at the very edge which nobody will ever notice)
+void Metrics_writeHistogram(MetricsText *t, const char *name, const char *help,
+                            const HistogramSnap *snap, int min_pow, int max_pow, double scale) {
+    Metrics_writeHeader(t, name, "histogram", help);
+
+    int i = 0;
+    uint64_t below = 0;
+    for (int p = min_pow; p <= max_pow && p < 64; p++) {
+        uint64_t edge = (uint64_t)1 << p;
+        while (i < HIST_BUCKETS && bucket_end(i) <= edge) {
+            below += snap->buckets[i];
+            i++;
+        }
+        MetricsText_printf(t, "%s_bucket{le=\"%.9g\"} %llu\n",
+                           name, (double)edge * scale, (unsigned long long)below);
+    }
+    MetricsText_printf(t, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)snap->count);
+    MetricsText_printf(t, "%s_sum", name);
+    write_value(t, (double)snap->sum * scale);
+    MetricsText_printf(t, "%s_count %llu\n", name, (unsigned long long)snap->count);
+}
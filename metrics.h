@@ -0,0 +1,69 @@
+// metrics.h
+// counters and latency histograms for the server plus the Prometheus text format to hand them out in
+// every value here is an atomic so the thread that counts never takes a lock, and a scrape can read
+// them at any time, at worst it sees a histogram half way through one record
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// HDR style log linear buckets, every power of two is split into HIST_SUB equal buckets
+// so a value is off by at most 1/HIST_SUB (12.5%) whether it is 300 ns or 3 seconds
+// values below HIST_SUB get a bucket each, the top bucket ends at 2^64
+#define HIST_SUB_BITS 3
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)   // 496
+
+typedef struct {
+    atomic_ulong count;
+    atomic_ulong sum;
+    atomic_ulong buckets[HIST_BUCKETS];
+} Histogram;
+
+// plain copy of one or more histograms added together, what a scrape works with
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[HIST_BUCKETS];
+} HistogramSnap;
+
+// text being put together for one scrape, grows as needed
+typedef struct {
+    char  *data;
+    size_t len;
+    size_t cap;
+    int    failed;   // an allocation failed somewhere, data holds what fit before that
+} MetricsText;
+
+// meant to be called on a histogram only one thread writes to, the atomics are relaxed and
+// never contended so this is a handful of ns (still correct if two threads do share one)
+void Histogram_record(Histogram *h, uint64_t v);
+
+// adds h into snap, so a few calls give the sum of several histograms
+void Histogram_snapshot(const Histogram *h, HistogramSnap *snap);
+
+// value below which a fraction q (0..1) of the recorded values are, as the upper end of the
+// bucket it falls into, 0 if nothing was recorded
+uint64_t HistogramSnap_percentile(const HistogramSnap *snap, double q);
+
+void MetricsText_init(MetricsText *t);
+void MetricsText_free(MetricsText *t);
+void MetricsText_printf(MetricsText *t, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// the # HELP and # TYPE lines, once per metric name before its samples
+void Metrics_writeHeader(MetricsText *t, const char *name, const char *type, const char *help);
+
+// one sample, labels is the part inside the braces like thread="reactor0" or NULL for none
+void Metrics_writeSample(MetricsText *t, const char *name, const char *labels, double value);
+
+// a whole Prometheus histogram (header, _bucket, _sum and _count) out of a snapshot
+// le boundaries are the powers of two from 2^min_pow to 2^max_pow, every value is multiplied
+// by scale on the way out (1e-9 turns recorded ns into the seconds Prometheus expects)
+void Metrics_writeHistogram(MetricsText *t, const char *name, const char *help,
+                            const HistogramSnap *snap, int min_pow, int max_pow, double scale);
+
+#endif
@@ -0,0 +1,159 @@
+// ringbuf.c
+// the receive ring behind every flower connection
+
+// the old reader assumed every read() was exactly one line which is just not how tcp works,
+// two status lines can show up glued together or one line can be cut in half
+// so bytes go into a ring and lines get framed as the newlines show up
+
+// the one trick in here is the spill area after the end of the ring
+// a message that wraps past the end gets its front part copied there so the caller still sees
+// one contiguous chunk, everything that does not wrap is handed out without any copy at all
+
+#include "ringbuf.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+int RingBuf_init(RingBuf *rb, size_t cap, size_t max_msg) {
+    if (rb == NULL || max_msg == 0) return 0;
+
+    size_t want = (cap < 2 * max_msg) ? 2 * max_msg : cap;
+    size_t real = 64;
+    while (real < want) real *= 2;
+
+    rb->buf = malloc(real + max_msg + 1);
+    if (rb->buf == NULL) return 0;
+
+    rb->cap      = real;
+    rb->max_msg  = max_msg;
+    rb->head     = 0;
+    rb->tail     = 0;
+    rb->scanned  = 0;
+    rb->skipping = 0;
+    return 1;
+}
+
+void RingBuf_free(RingBuf *rb) {
+    if (rb == NULL) return;
+    free(rb->buf);
+    rb->buf = NULL;
+}
+
+size_t RingBuf_used(const RingBuf *rb) {
+    return rb->tail - rb->head;
+}
+
+ssize_t RingBuf_readFrom(RingBuf *rb, int fd) {
+    size_t used = rb->tail - rb->head;
+    size_t room = rb->cap - used;
+    if (room == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    // free space is at most two pieces, from tail to the end of the ring and then from the start
+    size_t pos   = rb->tail & (rb->cap - 1);
+    size_t first = rb->cap - pos;
+    if (first > room) first = room;
+
+    struct iovec iov[2];
+    iov[0].iov_base = rb->buf + pos;
+    iov[0].iov_len  = first;
+    iov[1].iov_base = rb->buf;
+    iov[1].iov_len  = room - first;
+
+    ssize_t n = readv(fd, iov, (room > first) ? 2 : 1);
+    if (n > 0) rb->tail += (size_t)n;
+    return n;
+}
+
+// makes [head, head + n) contiguous by copying the wrapped part into the spill area
+// returns a pointer to the first byte
+static char *make_contiguous(RingBuf *rb, size_t n) {
+    size_t pos = rb->head & (rb->cap - 1);
+    if (pos + n > rb->cap) {
+        memcpy(rb->buf + rb->cap, rb->buf, pos + n - rb->cap);
+    }
+    return rb->buf + pos;
+}
+
+// looks for a newline in [head + scanned, tail) without rescanning bytes we already checked
+// returns its offset from head or -1
+static long find_newline(RingBuf *rb) {
+    size_t used = rb->tail - rb->head;
+    while (rb->scanned < used) {
+        size_t pos = (rb->head + rb->scanned) & (rb->cap - 1);
+        size_t run = rb->cap - pos;
+        if (run > used - rb->scanned) run = used - rb->scanned;
+
+        char *nl = memchr(rb->buf + pos, '\n', run);
+        if (nl != NULL) {
+            return (long)(rb->scanned + (size_t)(nl - (rb->buf + pos)));
+        }
+        rb->scanned += run;
+    }
+    return -1;
+}
+
+int RingBuf_nextLine(RingBuf *rb, const char **line, size_t *len) {
+    while (1) {
+        long nl = find_newline(rb);
+
+        if (rb->skipping) {
+            if (nl < 0) {
+                // still inside the overlong line, throw away what we have
+                rb->head = rb->tail;
+                rb->scanned = 0;
+                return 0;
+            }
+            rb->head += (size_t)nl + 1;
+            rb->scanned = 0;
+            rb->skipping = 0;
+            continue;
+        }
+
+        if (nl < 0) {
+            if (rb->tail - rb->head >= rb->max_msg) {
+                // no newline anywhere in a whole max_msg worth of bytes, this line is garbage
+                rb->head = rb->tail;
+                rb->scanned = 0;
+                rb->skipping = 1;
+                return -1;
+            }
+            return 0;
+        }
+
+        size_t n = (size_t)nl;
+        if (n >= rb->max_msg) {
+            rb->head += n + 1;
+            rb->scanned = 0;
+            return -1;
+        }
+
+        // the newline byte itself becomes the terminator, or the matching spill byte if it wrapped
+        char *p = make_contiguous(rb, n + 1);
+        size_t l = n;
+        while (l > 0 && p[l - 1] == '\r') l--;
+        p[l] = '\0';
+
+        rb->head += n + 1;
+        rb->scanned = 0;
+
+        *line = p;
+        *len  = l;
+        return 1;
+    }
+}
+
+const char *RingBuf_peek(RingBuf *rb, size_t n) {
+    if (n > rb->max_msg || rb->tail - rb->head < n) return NULL;
+    return make_contiguous(rb, n);
+}
+
+void RingBuf_consume(RingBuf *rb, size_t n) {
+    size_t used = rb->tail - rb->head;
+    if (n > used) n = used;
+    rb->head += n;
+    rb->scanned = (rb->scanned > n) ? rb->scanned - n : 0;
+}
@@ -0,0 +1,48 @@
+// ringbuf.h
+// per connection receive ring with incremental framing, one read can hold zero, one or many messages
+// messages come back as pointers straight into the ring so nothing gets copied on the way through
+
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct {
+    char   *buf;       // cap bytes of ring plus max_msg + 1 bytes of spill area right after it
+    size_t  cap;       // power of two
+    size_t  max_msg;   // longest message we will ever hand out
+    size_t  head;      // read position, counts up forever and gets masked on use
+    size_t  tail;      // write position, same deal
+    size_t  scanned;   // bytes after head already searched for a newline
+    int     skipping;  // throwing away an overlong line until its newline shows up
+} RingBuf;
+
+// cap gets rounded up to a power of two and to at least 2 * max_msg
+// returns 0 if the allocation failed
+int RingBuf_init(RingBuf *rb, size_t cap, size_t max_msg);
+
+void RingBuf_free(RingBuf *rb);
+
+// bytes currently buffered
+size_t RingBuf_used(const RingBuf *rb);
+
+// one readv() from fd straight into the free part of the ring
+// returns what readv returned, or -1 with errno = ENOBUFS if the ring is full
+ssize_t RingBuf_readFrom(RingBuf *rb, int fd);
+
+// next complete line without its \n (and \r), nul terminated in place
+//   returns 1 and sets *line / *len if a line was ready
+//   returns 0 if more bytes are needed
+//   returns -1 if a line longer than max_msg was thrown away
+// the pointer stays valid until the next RingBuf_readFrom
+int RingBuf_nextLine(RingBuf *rb, const char **line, size_t *len);
+
+// contiguous view of the first n buffered bytes (n <= max_msg) without consuming them,
+// NULL if fewer than n bytes are buffered
+const char *RingBuf_peek(RingBuf *rb, size_t n);
+
+// drop n bytes from the front, used after RingBuf_peek
+void RingBuf_consume(RingBuf *rb, size_t n);
+
+#endif
@@ -0,0 +1,89 @@
+// ticker.c
+// the clock behind the flower motion loops
+
+// usleep(100ms) then "100ms passed" was only true when nothing else took any time,
+// under load every tick ran a little long and the petals fell behind the real clock
+// here the deadlines are absolute and the elapsed time handed back is what really passed,
+// leftover nanoseconds carry over to the next tick so nothing gets rounded away
+
+#include "ticker.h"
+#include <errno.h>
+#include <time.h>
+
+#define NS_PER_MS  1000000LL
+#define NS_PER_SEC 1000000000LL
+
+static int64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+void Ticker_init(Ticker *t, int tick_ms, int max_catchup_ms) {
+    if (tick_ms < 1) tick_ms = 1;
+    if (max_catchup_ms < tick_ms) max_catchup_ms = tick_ms;
+
+    int64_t now = mono_ns();
+    t->tick_ms        = tick_ms;
+    t->max_catchup_ms = max_catchup_ms;
+    t->next_ns        = now + tick_ms * NS_PER_MS;
+    t->sim_ns         = now;
+    t->resyncs        = 0;
+}
+
+void Ticker_reset(Ticker *t) {
+    int64_t now = mono_ns();
+    t->next_ns = now + t->tick_ms * NS_PER_MS;
+    t->sim_ns  = now;
+}
+
+void Ticker_deadline(const Ticker *t, struct timespec *ts) {
+    ts->tv_sec  = (time_t)(t->next_ns / NS_PER_SEC);
+    ts->tv_nsec = (long)(t->next_ns % NS_PER_SEC);
+}
+
+int Ticker_due(const Ticker *t) {
+    return mono_ns() >= t->next_ns;
+}
+
+int Ticker_catchUp(Ticker *t) {
+    int64_t due_ms = (mono_ns() - t->sim_ns) / NS_PER_MS;
+    if (due_ms <= 0) return 0;
+    if (due_ms > t->max_catchup_ms) {
+        // same as in Ticker_wait, a long stall is only played up to max_catchup_ms
+        t->sim_ns += (due_ms - t->max_catchup_ms) * NS_PER_MS;
+        due_ms = t->max_catchup_ms;
+        t->resyncs++;
+    }
+    t->sim_ns += due_ms * NS_PER_MS;
+    return (int)due_ms;
+}
+
+int Ticker_wait(Ticker *t) {
+    struct timespec ts;
+    Ticker_deadline(t, &ts);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        // signal, just go back to sleep until the same deadline
+    }
+
+    int64_t now = mono_ns();
+
+    // next deadline stays on the original grid, but if we are already past it
+    // (a stall longer than a tick) start a fresh grid instead of firing a burst of ticks
+    t->next_ns += t->tick_ms * NS_PER_MS;
+    if (t->next_ns <= now) {
+        t->next_ns = now + t->tick_ms * NS_PER_MS;
+    }
+
+    int64_t due_ms = (now - t->sim_ns) / NS_PER_MS;
+    if (due_ms > t->max_catchup_ms) {
+        // stalled for ages (stopped in a debugger, laptop lid, ...), replaying all of it
+        // would just be a long freeze followed by a jump, so only max_catchup_ms of it is played
+        t->sim_ns += (due_ms - t->max_catchup_ms) * NS_PER_MS;
+        due_ms = t->max_catchup_ms;
+        t->resyncs++;
+    }
+    t->sim_ns += due_ms * NS_PER_MS;
+
+    return (int)due_ms;
+}
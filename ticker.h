@@ -0,0 +1,43 @@
+// ticker.h
+// fixed rate tick driven by absolute CLOCK_MONOTONIC deadlines instead of sleeping a fixed amount,
+// so time spent locking, printing and writing between ticks never adds up into drift
+
+#ifndef TICKER_H
+#define TICKER_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef struct {
+    int64_t next_ns;          // absolute deadline of the next tick
+    int64_t sim_ns;           // how far the caller has been told to simulate
+    int     tick_ms;
+    int     max_catchup_ms;   // longest stretch handed out after a stall, the rest is skipped
+    unsigned long resyncs;    // times a stall was longer than that
+} Ticker;
+
+void Ticker_init(Ticker *t, int tick_ms, int max_catchup_ms);
+
+// sleeps until the next deadline and returns how many ms of motion are due since the last call
+// normally that is tick_ms, after a stall it is everything that was missed (up to max_catchup_ms)
+// and the missed deadlines are skipped instead of fired back to back
+// the caller should step in pieces of at most tick_ms so sequence delays land where they should
+int Ticker_wait(Ticker *t);
+
+// absolute CLOCK_MONOTONIC time of the next tick, for callers that sleep on something else
+// (a condition variable) until then and call Ticker_wait once it has passed
+void Ticker_deadline(const Ticker *t, struct timespec *ts);
+
+// 1 once the next deadline has passed, Ticker_wait would not sleep
+int Ticker_due(const Ticker *t);
+
+// hands out the motion due between the last tick and right now, for callers that need the
+// state to be current at some moment between ticks (a command with a start time)
+// the next Ticker_wait then only hands out the rest of its tick
+int Ticker_catchUp(Ticker *t);
+
+// start a fresh grid from now, for callers that slept on something else on purpose
+// and do not want that time replayed
+void Ticker_reset(Ticker *t);
+
+#endif
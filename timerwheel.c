@@ -0,0 +1,138 @@
+// timerwheel.c
+// the scheduler behind BLOOM and anything else the server wants to do "in a bit"
+
+// level 0 has one slot per ms for the next 64 ms, level 1 one slot per 64 ms and so on
+// a timer goes into the coarsest level it fits and gets moved down a level (cascaded)
+// when the wheel below it wraps around, so every timer is touched at most 4 times
+
+#include "timerwheel.h"
+#include <stddef.h>
+#include <string.h>
+
+static void wheel_link(TimerWheel *tw, TimerNode *n, int level, int slot) {
+    n->level = (unsigned char)level;
+    n->slot  = (unsigned char)slot;
+    n->prev  = NULL;
+    n->next  = tw->slots[level][slot];
+    if (n->next != NULL) n->next->prev = n;
+    tw->slots[level][slot] = n;
+    tw->occupied[level] |= (1ull << slot);
+    n->pending = 1;
+    tw->count++;
+}
+
+static void wheel_unlink(TimerWheel *tw, TimerNode *n) {
+    if (n->prev != NULL) {
+        n->prev->next = n->next;
+    } else {
+        tw->slots[n->level][n->slot] = n->next;
+    }
+    if (n->next != NULL) n->next->prev = n->prev;
+    if (tw->slots[n->level][n->slot] == NULL) {
+        tw->occupied[n->level] &= ~(1ull << n->slot);
+    }
+    n->next = NULL;
+    n->prev = NULL;
+    n->pending = 0;
+    tw->count--;
+}
+
+// key is the tick the timer has to fire on and is never before tw->now
+static void wheel_place(TimerWheel *tw, TimerNode *n, uint64_t key) {
+    uint64_t delta = key - tw->now;
+
+    for (int level = 0; level < TIMER_LEVELS; level++) {
+        int shift = level * TIMER_SLOT_BITS;
+        if (delta < (1ull << (shift + TIMER_SLOT_BITS))) {
+            wheel_link(tw, n, level, (int)((key >> shift) & (TIMER_SLOTS - 1)));
+            return;
+        }
+    }
+
+    // further out than the whole wheel, park it in the last top level slot
+    // and it gets placed again from there when that slot cascades
+    int shift = (TIMER_LEVELS - 1) * TIMER_SLOT_BITS;
+    uint64_t far = tw->now + (1ull << (shift + TIMER_SLOT_BITS)) - 1;
+    wheel_link(tw, n, TIMER_LEVELS - 1, (int)((far >> shift) & (TIMER_SLOTS - 1)));
+}
+
+static void wheel_cascade(TimerWheel *tw, int level, int slot) {
+    TimerNode *n;
+    while ((n = tw->slots[level][slot]) != NULL) {
+        wheel_unlink(tw, n);
+        wheel_place(tw, n, (n->expires < tw->now) ? tw->now : n->expires);
+    }
+}
+
+// distance from bit "start" to the first set bit going around the 64 slots
+static int next_set_slot(uint64_t bits, int start) {
+    uint64_t rot = (start == 0) ? bits : ((bits >> start) | (bits << (64 - start)));
+    return __builtin_ctzll(rot);
+}
+
+void TimerWheel_init(TimerWheel *tw, uint64_t now_ms) {
+    memset(tw, 0, sizeof(*tw));
+    tw->now = now_ms;
+}
+
+void TimerWheel_add(TimerWheel *tw, TimerNode *n, uint64_t expires_ms) {
+    if (n->pending) wheel_unlink(tw, n);
+    n->expires = expires_ms;
+    wheel_place(tw, n, (expires_ms <= tw->now) ? tw->now + 1 : expires_ms);
+}
+
+void TimerWheel_cancel(TimerWheel *tw, TimerNode *n) {
+    if (n->pending) wheel_unlink(tw, n);
+}
+
+int TimerWheel_advance(TimerWheel *tw, uint64_t now_ms) {
+    int fired = 0;
+
+    while (tw->now < now_ms) {
+        if (tw->count == 0) {
+            // nothing pending so there is nothing to walk through
+            tw->now = now_ms;
+            break;
+        }
+
+        uint64_t t = ++tw->now;
+
+        // higher levels first, what comes down from level 2 may have to go on down to level 0
+        for (int level = TIMER_LEVELS - 1; level > 0; level--) {
+            int shift = level * TIMER_SLOT_BITS;
+            if ((t & ((1ull << shift) - 1)) == 0) {
+                wheel_cascade(tw, level, (int)((t >> shift) & (TIMER_SLOTS - 1)));
+            }
+        }
+
+        // pop one at a time, a callback can cancel a timer that sits in the same slot
+        int slot = (int)(t & (TIMER_SLOTS - 1));
+        TimerNode *n;
+        while ((n = tw->slots[0][slot]) != NULL) {
+            wheel_unlink(tw, n);
+            n->fn(n);
+            fired++;
+        }
+    }
+
+    return fired;
+}
+
+int TimerWheel_nextExpiry(const TimerWheel *tw, uint64_t *when_ms) {
+    if (tw->count == 0) return 0;
+
+    uint64_t best = UINT64_MAX;
+    for (int level = 0; level < TIMER_LEVELS; level++) {
+        if (tw->occupied[level] == 0) continue;
+
+        // level 0 answers with the exact tick, upper levels with the tick their slot cascades on
+        int shift = level * TIMER_SLOT_BITS;
+        uint64_t cur = tw->now >> shift;
+        int start = (int)((cur + 1) & (TIMER_SLOTS - 1));
+        uint64_t when = (cur + 1 + (uint64_t)next_set_slot(tw->occupied[level], start)) << shift;
+        if (when < best) best = when;
+    }
+
+    *when_ms = best;
+    return 1;
+}
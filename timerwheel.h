@@ -0,0 +1,54 @@
+// timerwheel.h
+// hierarchical timer wheel with millisecond ticks, used by the reactors to fire scheduled commands
+// adding, cancelling and firing a timer are all O(1), it does not matter how many are pending
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdint.h>
+
+#define TIMER_LEVELS     4
+#define TIMER_SLOT_BITS  6
+#define TIMER_SLOTS      (1 << TIMER_SLOT_BITS)   // 64 slots per level, 4 levels cover about 4.6 hours
+
+typedef struct TimerNode TimerNode;
+typedef void (*TimerFn)(TimerNode *node);
+
+// callers put one of these inside their own struct and get it back in the callback
+struct TimerNode {
+    TimerNode *next;
+    TimerNode *prev;
+    uint64_t   expires;   // absolute time in ms, same clock that is passed to advance
+    TimerFn    fn;
+    void      *arg;
+    int        pending;   // 1 while it sits in a wheel
+    unsigned char level;  // where it sits, only meaningful while pending
+    unsigned char slot;
+};
+
+typedef struct {
+    uint64_t   now;                                   // last tick that was processed
+    TimerNode *slots[TIMER_LEVELS][TIMER_SLOTS];
+    uint64_t   occupied[TIMER_LEVELS];                // bit per non empty slot
+    int        count;
+} TimerWheel;
+
+void TimerWheel_init(TimerWheel *tw, uint64_t now_ms);
+
+// expires in the past (or right now) fires on the next advance
+void TimerWheel_add(TimerWheel *tw, TimerNode *n, uint64_t expires_ms);
+
+// safe to call on a node that already fired or was never added
+void TimerWheel_cancel(TimerWheel *tw, TimerNode *n);
+
+// runs the callback of every timer that is due by now_ms, in expiry order
+// a callback is allowed to add new timers or free its own node
+// returns how many fired
+int TimerWheel_advance(TimerWheel *tw, uint64_t now_ms);
+
+// earliest time the wheel needs to be advanced again, returns 0 if nothing is pending
+// this can be a bit earlier than the real next expiry when the next timer still sits in
+// an upper level, advancing then just cascades it down and asks again
+int TimerWheel_nextExpiry(const TimerWheel *tw, uint64_t *when_ms);
+
+#endif